@@ -25,7 +25,7 @@ if(__name__ == "__main__"):
     
     while True:
         finished = sn.histogram.isFinished()
-        data, bins = sn.histogram.getData()
+        data, bins, seq = sn.histogram.getSnapshot()
         
         # 1s refresh time
         plt.pause(1)
@@ -0,0 +1,54 @@
+from snAPI.Main import *
+import matplotlib
+matplotlib.use('TkAgg',force=True)
+from matplotlib import pyplot as plt
+print("Switched to:",matplotlib.get_backend())
+
+if(__name__ == "__main__"):
+
+    sn = snAPI()
+    sn.getDevice()
+    
+    # alternatively read data from file
+    #sn.getFileDevice(r"C:\Data\PicoQuant\default.ptu")
+    sn.initDevice(MeasMode.T2)
+    
+    # set the configuration for your device type
+    sn.loadIniConfig("config\MH.ini")
+    
+    # all consumers get the data of the same acquisition
+    histo = sn.pipeline.histogram(refChannel=0, binWidth=100, numBins=1000)
+    trace = sn.pipeline.timeTrace(numBins=1000, historySize=10)
+    g2 = sn.pipeline.correlation(1, 2, 50000, 100, threaded=True)
+    
+    # measure 10s
+    sn.pipeline.start(10000, savePTU=False)
+    
+    while True:
+        finished = sn.pipeline.isFinished()
+        histoData, histoBins = histo.getData()
+        counts, times = trace.getData()
+        g2Data, g2Bins = g2.getData()
+        
+        plt.clf()
+        plt.subplot(311)
+        for c in range(1, 1+sn.deviceConfig["NumChans"]):
+            plt.plot(histoBins, histoData[c], linewidth=2.0, label=f'chan{c}')
+        plt.xlabel('Time [ps]')
+        plt.ylabel('Counts')
+        plt.legend()
+        plt.subplot(312)
+        for c in range(1, 1+sn.deviceConfig["NumChans"]):
+            plt.plot(times, counts[c], linewidth=2.0, label=f'chan{c}')
+        plt.xlabel('Time [s]')
+        plt.ylabel('Counts[Cts/s]')
+        plt.subplot(313)
+        plt.plot(g2Bins, g2Data, linewidth=2.0, label='g(2)')
+        plt.xlabel('Time [s]')
+        plt.ylabel('g(2)')
+        plt.pause(0.1)
+        
+        if finished:
+            break
+    
+    plt.show(block=True)
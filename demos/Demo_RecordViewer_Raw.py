@@ -19,5 +19,6 @@ if(__name__ == "__main__"):
     sn.logPrint("channel   | timetag") 
     sn.logPrint("-------------------")
     
-    for i in range(start,start+length):
-        sn.logPrint(f"{sn.raw.channel(data[i]):9} | {sn.raw.dTime_T3(data[i]):7}")
\ No newline at end of file
+    channels, _, dTimes, _ = sn.raw.decodeBlock(data[start:start+length], timeTags=False, markers=False)
+    for channel, dTime in zip(channels, dTimes):
+        sn.logPrint(f"{channel:9} | {dTime:7}")
\ No newline at end of file
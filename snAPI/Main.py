@@ -1,14 +1,22 @@
 # Torsten Krause, PicoQuant GmbH, 2023
 
+import concurrent.futures
 import ctypes as ct
+import glob
 import inspect
+import itertools
 import json
+import multiprocessing
 import numpy as np
 import os
+import queue
+import re
 import sys
+import threading
 import time
 import traceback
 import typing
+import uuid
 
 from datetime import datetime, timezone
 from snAPI.Constants import *
@@ -26,6 +34,10 @@ Note
 ----
 Creating the snAPI object calls :meth:`initAPI`. Please look there for detailed information.
 
+The calls into the snAPI.dll release the GIL while they run (e.g. `measure(waitFinished=True)` or the reading
+of the blocks), so other Python threads go on meanwhile. The data is returned as numpy arrays on the buffers
+of the API without a copy, they are valid until the next measurement overwrites them.
+
 Parameters
 ----------
     systemIni: str
@@ -44,7 +56,7 @@ Example
     sn = snAPI()
         
     """
-    dll = ct.WinDLL(os.path.abspath(os.path.join(os.path.dirname(__file__), '.\snAPI64.dll')))
+    dll = setPrototypes(ct.WinDLL(os.path.abspath(os.path.join(os.path.dirname(__file__), '.\snAPI64.dll'))))
     """
 the snAPI.dll
 
@@ -219,6 +231,8 @@ Example
         """This is the object to :class:`Correlation`. class"""
         self.manipulators = Manipulators(self)
         """This is the object to :class:`Manipulators`. class"""
+        self.pipeline = Pipeline(self)
+        """This is the object to :class:`Pipeline`. class"""
         self.initAPI(systemIni)
 
 
@@ -262,7 +276,6 @@ Example
         """
         summarized_args = " ".join(map(str, args))
         summarized_kwargs = " ".join([f"{key}={value}" for key, value in kwargs.items()])
-        self.dll.logExternal.argtypes = [ct.c_char_p]
         if summarized_args and summarized_kwargs:
             self.dll.logExternal(f"{summarized_args} {summarized_kwargs}".encode('utf-8'))
         elif summarized_args:
@@ -287,8 +300,7 @@ Example
     230911_12:02:53.5351972 ERR                    ~~~~~~~~^^^^^^^^^^^^^^
 
         """
-        dll = ct.WinDLL(os.path.abspath(os.path.join(os.path.dirname(__file__), '.\snAPI64.dll')))
-        dll.logError.argtypes = [ct.c_char_p]
+        dll = setPrototypes(ct.WinDLL(os.path.abspath(os.path.join(os.path.dirname(__file__), '.\snAPI64.dll'))))
         dll.logError(f"Uncaught python exception: {exception_type.__name__}!".encode('utf-8'))
         dll.logError(f"Text: {exception}".encode('utf-8'))
         if eTraceback:
@@ -377,14 +389,122 @@ Example
         # buffer size in number ofb blocks of 1048576 Bytes
         [Params]
         BufferSize = 128
+        
+        # threads of snAPI in Python (see setThreadSettings)
+        [Threads]
+        Workers = 8
+        ReaderCpus = 2
+        ReaderPriority = TimeCritical
+        PipelineCpus = 3
+        WorkerCpus = 4-11
     
         """
         SBuf = systemIni.encode('utf-8')
         ok = self.dll.initAPI(SBuf)
+        try:
+            threadSettings.load(systemIni)
+        except ValueError as e:
+            self.logPrint(f"{Color.Red}Invalid [Threads] section in {systemIni}, the default thread settings are used: {e}")
         self.getDeviceConfig()
         return ok
 
 
+    def setThreadSettings(self, role: str, cpus: typing.Optional[typing.List[int]] = None, priority: typing.Optional[str] = None,
+                          workers: typing.Optional[int] = None):
+        """
+This function sets the CPU affinity and the priority of the threads snAPI starts in Python (see
+:class:`snAPI.Utils.ThreadSettings`). They are applied to the threads that are started afterwards. Pinning the
+reader threads to their own cores keeps the operating system from moving them and other programs (e.g. a GUI)
+from taking their time. The memory of the ring of a pinned reader is allocated on the NUMA node of its cores.
+The settings can also be set in the [Threads] section of the system.ini (see :meth:`initAPI`).
+
+Note
+----
+    The threads inside the API are not affected. Higher priorities may need administrator rights.
+
+Parameters
+----------
+    role: str
+        | "Reader": reading the blocks from the API (stream rings)
+        | "Pipeline": decoding and manipulators of the :class:`Pipeline`
+        | "Worker": threaded consumers and thread pools
+        | "Writer": file writers
+    cpus: List[int] (default: None - all)
+        cpus the threads may run on
+    priority: str (default: None - unchanged)
+        Idle, Lowest, BelowNormal, Normal, AboveNormal, Highest or TimeCritical
+    workers: int (default: None - unchanged)
+        number of worker threads of the thread pools (e.g. :meth:`Pipeline.startFile`)
+
+Returns
+-------
+    True:  operation successful
+    False: operation failed
+
+Example
+-------
+::
+
+    # the reader on core 2 with the highest priority, the workers on the second socket
+    sn.setThreadSettings("Reader", [2], "TimeCritical")
+    sn.setThreadSettings("Worker", list(range(16, 32)), workers=16)
+
+        """
+        try:
+            threadSettings.set(role, cpus, priority)
+        except ValueError as e:
+            self.logPrint(f"{Color.Red}{e}")
+            return False
+        if workers is not None:
+            threadSettings.workers = workers
+        return True
+
+
+    def setBufferPool(self, enable: typing.Optional[bool] = True, largePages: typing.Optional[bool] = False, prefault: typing.Optional[bool] = False):
+        """
+This function enables the pool of the measurement buffers (see :class:`snAPI.Utils.BufferPool`). The arrays of
+:class:`Raw`, :class:`Unfold`, :class:`Histogram`, :class:`TimeTrace` and :class:`Correlation` are then kept
+after a measurement and reused by the next one, so many short measurements (e.g. scans) do not allocate and
+zero-fill up to some GB each time.
+
+Warning
+-------
+    The arrays returned by `getData` of a measurement are overwritten by the next measurement. Copy them if
+    they are needed afterwards.
+
+Parameters
+----------
+    enable: bool (default: True)
+        | True: reuse the buffers
+        | False: allocate new buffers for every measurement (default behaviour), the pool is freed
+    largePages: bool (default: False)
+        back the buffers with large pages (Windows: needs the 'Lock pages in memory' right)
+    prefault: bool (default: False)
+        touch all pages of a new buffer at the allocation
+
+Returns
+-------
+    dict: stats of the pool
+        | NumAllocs: number of allocated buffers
+        | NumReuses: number of reused buffers
+        | OwnedBytes / FreeBytes: size of the buffers in use / waiting [bytes]
+
+Example
+-------
+::
+
+    sn.setBufferPool(True, largePages=True)
+    for level in range(-500, 0):
+        sn.device.setInputEdgeTrig(-1, level, 0)
+        sn.unfold.measure(100, size=1000000)
+        times, channels = sn.unfold.getData()
+        ...
+
+        """
+        bufferPool.configure(enable, largePages, prefault)
+        return bufferPool.getStats()
+
+
     def exitAPI(self,):
         """
 This is function is called in the snAPI destructor. 
@@ -608,6 +728,11 @@ This function sets the path to the ptu file, if the measurement supports writing
 If no special path is set the file will be written to the data path defined in the INI file
 that was called with :meth:`initAPi`. The default file name ist default.ptu.
 
+Note
+----
+    For long measurements a compressed container file can be written with :meth:`Pipeline.record` instead, or a
+    ptu file can be converted with :func:`snAPI.Utils.compressPTU`.
+
 Parameters
 ----------
     path: str
@@ -920,11 +1045,52 @@ Example
     
         """
         syncPeriod =  ct.c_double(0)
-        self.dll.getSyncPeriod.argtypes = [ct.POINTER(ct.c_double)]
         ok = self.dll.getSyncPeriod(ct.pointer(syncPeriod))
         return syncPeriod.value
 
 
+    def getPipelineStats(self):
+        """
+This function returns the telemetry of the data processing on the Python side: every stage of the
+:class:`Pipeline` (see :meth:`Pipeline.getStats`) and the rings of the streams of :class:`Raw` and :class:`Unfold`
+with their dropped records, high-water marks and the PTU writer (see :meth:`Raw.getStreamStats`). It shows which
+stage limits the throughput.
+
+Note
+----
+    The stages inside the API (USB/FIFO read, unfolding, manipulators of the API) are not included.
+
+Parameters
+----------
+    None
+
+Returns
+-------
+    dict:
+        | Pipeline: stats of the pipeline stages by name
+        | RawStream: stats of the `Raw` stream ring (if running)
+        | UnfoldStream: stats of the `Unfold` stream ring (if running)
+
+Example
+-------
+::
+
+    sn.pipeline.start(10000)
+    while not sn.pipeline.isFinished():
+        stats = sn.getPipelineStats()
+        for name, stage in stats["Pipeline"].items():
+            print(name, stage)
+        time.sleep(1)
+
+        """
+        stats = {"Pipeline": self.pipeline.getStats()}
+        if self.raw.ring is not None:
+            stats["RawStream"] = self.raw.getStreamStats()
+        if self.unfold.ring is not None:
+            stats["UnfoldStream"] = self.unfold.getStreamStats()
+        return stats
+
+
     def getNumAllChannels(self,):
         """
 This functions returns the number of available channels from the active device has plus the number of channels for
@@ -2025,7 +2191,6 @@ Example
         for i in passChans:
             pc |= pow(2, i)
 
-        self.parent.dll.setRowEventFilter.restype = ct.c_bool
         return self.parent.dll.setRowEventFilter(row, timeRange, matchCount, inverse, uc, pc)
 
 
@@ -2057,7 +2222,6 @@ Example
     sn.filter.enableRow(0, True)
     
         """
-        self.parent.dll.enableRowEventFilter.restype = ct.c_bool
         return self.parent.dll.enableRowEventFilter(row, enable)
 
 
@@ -2105,7 +2269,6 @@ Example
     sn.filter.setMainParams(0, 1000, 1, False
     
         """
-        self.parent.dll.setMainEventFilterParams.restype = ct.c_bool
         return self.parent.dll.setMainEventFilterParams(timeRange, matchCount, inverse)
 
 
@@ -2161,7 +2324,6 @@ Example
         for i in passChans:
             pc |= pow(2, i)
         
-        self.parent.dll.setMainEventFilterChannels.restype = ct.c_bool
         return self.parent.dll.setMainEventFilterChannels(row, uc, pc)
 
 
@@ -2198,7 +2360,6 @@ Example
     sn.filter.enableMain(True)
     
         """
-        self.parent.dll.enableMainEventFilter.restype = ct.c_bool
         return self.parent.dll.enableMainEventFilter(enable)
         #     self.parent.deviceConfig["SyncDiv"] = syncDiv
         # return ok
@@ -2235,7 +2396,6 @@ Example
     sn.filter.setTestMode(True)
     
         """
-        self.parent.dll.setFilterTestMode.restype = ct.c_bool
         return self.parent.dll.setFilterTestMode(testMode)
         #     self.parent.deviceConfig["SyncDiv"] = syncDiv
         # return ok
@@ -2443,7 +2603,6 @@ Example
         try:
             self.SFPnames = list(filter(None,str(names, "utf-8").replace('\x00','\n').splitlines()))
         except UnicodeDecodeError as e:
-            self.parent.dll.logError.argtypes = [ct.c_char_p]
             self.parent.dll.logError(f"Invalid response @ getSFPData: '{e.reason}'".encode('utf-8'))
         self.SFPdTxs = np.array(dTxs)
         self.SFPdRxs = np.array(dRxs)
@@ -2553,7 +2712,6 @@ Example
     sn.whiteRabbit.SetMode(reinitWithMode= True, mode = WRmode.Master)
         """
         script = (ct.c_char * 256)()
-        self.parent.dll.WRabbitSetMode.restype = ct.c_bool
         return self.parent.dll.WRabbitSetMode(bootFromScript, reinitWithMode, mode.value)
     
     def getTime(self,):
@@ -2610,7 +2768,6 @@ Example
     
         """
         t = ct.c_uint64(round(time.replace(tzinfo=timezone.utc).timestamp()))
-        self.parent.dll.WRabbitSetTime.restype = ct.c_bool
         return self.parent.dll.WRabbitSetTime(t)
     
     def initLink(self, onOff: bool):
@@ -2638,7 +2795,6 @@ Example
     # switches the WR link on
     sn.whiteRabbit.initLink(True)
         """
-        self.parent.dll.WRabbitInitLink.restype = ct.c_bool
         return self.parent.dll.WRabbitInitLink(onOff)
     
     def getStatus(self,):
@@ -2786,6 +2942,10 @@ There are special functions to decode the :obj:`.MeasMode.T2`and :obj:`.MeasMode
     - :meth:`isMarker`
     - :meth:`markers`
 
+There are also functions to decode whole blocks of records at once with numpy:
+    - :meth:`decodeBlock`
+    - :meth:`unfoldBlock`
+
 .. seealso ::
     | To fully understand the TTTR format please read the MultiHarp manual and/or
     | :fa:`file-pdf` `Time Tagged Time-Resolved Fluorescence Data Collection in Life Sciences <https://www.picoquant.com/images/uploads/page/files/14528/technote_tttr.pdf>`_
@@ -2798,6 +2958,9 @@ There are special functions to decode the :obj:`.MeasMode.T2`and :obj:`.MeasMode
         self.data = ct.ARRAY(ct.c_uint32, 0)()
         self.finished = ct.pointer(ct.c_bool(False))
         self.idx = ct.pointer(ct.c_uint64(0))
+        self.ring = None
+        self.decoder = None
+        self.writer = None
         
 
     def measure(self, acqTime: typing.Optional[int] = 1000, size: typing.Optional[int] = 134217728, waitFinished: typing.Optional[bool] = True, savePTU: typing.Optional[bool] = False):
@@ -2858,11 +3021,12 @@ Example
     sn.raw.measure(1000, 134217728, True, True)
     
         """
-        self.data = ct.ARRAY(ct.c_uint32, size)()
+        self._stopStream()
+        self.decoder = None
+        self.data = bufferPool.array(ct.c_uint32, size, "Raw.data")
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "measurement is not supported for Raw class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
-        self.parent.dll.rawMeasure.restype = ct.c_bool
         return self.parent.dll.rawMeasure(acqTime, waitFinished, savePTU, ct.byref(self.data), self.idx, ct.c_uint64(size), self.finished)
     
 
@@ -2914,12 +3078,13 @@ Example
             sn.logPrint(f"{sn.raw.numRead()} records read")
     
         """
-        self.storeData = ct.ARRAY(ct.c_uint32, size)()
-        self.data = ct.ARRAY(ct.c_uint32, size)()
+        self._stopStream()
+        self.decoder = None
+        self.storeData = bufferPool.array(ct.c_uint32, size, "Raw.storeData")
+        self.data = bufferPool.array(ct.c_uint32, size, "Raw.data")
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "startBlock is not supported for Raw class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
-        self.parent.dll.rawStartBlock.restype = ct.c_bool
         return self.parent.dll.rawStartBlock(acqTime, savePTU, ct.byref(self.storeData), ct.c_uint64(size), self.finished)
     
 
@@ -2960,6 +3125,205 @@ Example
             self.parent.dll.rawGetBlock(ct.byref(self.data), size)
             self.idx.contents.value = size.contents.value
         return self.getData()
+
+
+    def startStream(self, acqTime: typing.Optional[int] = 1000, size: typing.Optional[int] = 8388608, numBlocks: typing.Optional[int] = 8,
+                    savePTU: typing.Optional[bool] = False, dropOnFull: typing.Optional[bool] = False, pollTime: typing.Optional[float] = 10,
+                    ptuPath: typing.Optional[str] = None, queueDepth: typing.Optional[int] = 16, bufferSize: typing.Optional[int] = 4194304):
+        """
+This function starts a block-wise measurement like :meth:`startBlock`, but the blocks are collected in a ring
+of `numBlocks` blocks by a separate thread. The blocks are written directly into the ring and handed out by
+:meth:`acquireBlock` as views onto the ring memory, so no further copy is needed to keep them.
+After processing a block it has to be given back with :meth:`releaseBlock`.
+
+If the ring is full the thread waits until a block is released (backpressure). With `dropOnFull` the block
+is discarded instead and the number of lost records is counted in :meth:`getStreamStats`.
+
+With `ptuPath` the blocks are written to a ptu file by a :class:`snAPI.Utils.PTUWriter` on its own I/O thread
+(instead of `savePTU`). The blocks are copied into a pool of `queueDepth` aligned buffers and the acquisition
+only waits for the disk if all of them are in use. The file is complete when the stream is stopped. If a write
+fails, the writing stops and the error is logged and shown in :meth:`getStreamStats`. Only this stream writes
+through the I/O thread, the other measurements write their ptu files with `savePTU` inside the API.
+
+Warning
+-------
+    If the ring stays full for a longer time, the internal store of the API runs over as it does for
+    :meth:`startBlock` ('WRN RawStore buffer overrun - clearing!'). Use more or larger blocks in this case.
+
+Parameters
+----------
+    acqTime: int (default: 1s)
+        | 0: means the measurement will run until :meth:`stopMeasure`
+        | acquisition time [ms]
+        | will be ignored if device is a FileDevice
+    size: int number of records (default: 8 million records = 32MB)
+        size of one block
+    numBlocks: int (default: 8)
+        number of blocks in the ring
+    savePTU: bool (default: False)
+        Save data to ptu file
+    dropOnFull: bool (default: False)
+        | True: drop blocks if the ring is full and count them
+        | False: wait until the consumer releases a block
+    pollTime: float (default: 10ms)
+        time between two block reads of the ring thread [ms]
+    ptuPath: str (default: None)
+        path of the ptu file written on the I/O thread
+    queueDepth: int (default: 16)
+        number of buffers of the I/O thread
+    bufferSize: int (default: 4MB)
+        size of one buffer of the I/O thread [bytes]
+
+Returns
+-------
+    True: operation successful
+    False: operation failed
+
+Example
+-------
+::
+
+    # reads `Raw` data for 10 seconds in :obj:`.MeasMode.T2` without copying the blocks
+    sn.raw.startStream(10000)
+    while True:
+        finished = sn.raw.isFinished()
+        data = sn.raw.acquireBlock()
+        if len(data):
+            ...
+        sn.raw.releaseBlock()
+        if finished:
+            break
+    
+        """
+        self._stopStream()
+        self.decoder = None
+        if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
+            self.parent.logPrint( "startStream is not supported for Raw class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
+            return False
+        onBlock = None
+        if ptuPath:
+            # the file is opened before the measurement starts, so a failed open does not leave it running
+            try:
+                self.writer = PTUWriter(ptuPath, self._ptuTags(), bufferSize, queueDepth)
+            except OSError as e:
+                self.parent.logPrint(f"{Color.Red}Can't open {ptuPath}: {e}")
+                self.writer = None
+                return False
+            onBlock = lambda views: self.writer.write(views[0])
+        self.storeData = bufferPool.array(ct.c_uint32, size, "Raw.storeData")
+        if not self.parent.dll.rawStartBlock(acqTime, savePTU, ct.byref(self.storeData), ct.c_uint64(size), self.finished):
+            if self.writer:
+                # the file only holds the header
+                self.writer.close()
+                self.writer = None
+                try:
+                    os.remove(ptuPath)
+                except OSError:
+                    pass
+            return False
+        self.ring = BlockRing([ct.c_uint32], size, numBlocks)
+        
+        def fetch(ptrs):
+            length = ct.pointer(ct.c_uint64(0))
+            self.parent.dll.rawGetBlock(ptrs[0], length)
+            return length.contents.value
+        
+        onEnd = self.writer.close if self.writer else None
+        self.ring.startProducer(fetch, lambda: self.finished.contents.value, pollTime, dropOnFull, onBlock, onEnd)
+        return True
+    
+
+    def acquireBlock(self):
+        """
+This function returns the oldest block of the ring started with :meth:`startStream` as a view onto the ring memory.
+The view stays valid until :meth:`releaseBlock` is called.
+
+Parameters
+----------
+    None
+
+Returns
+-------
+    NDArray[int]:
+        `Raw` data (empty if no block is available)
+    
+        """
+        block = self.ring.acquire() if self.ring else None
+        if block is None:
+            self.idx.contents.value = 0
+            return np.empty(0, dtype=np.uint32)
+        self.idx.contents.value = len(block[0])
+        return block[0]
+    
+
+    def releaseBlock(self):
+        """
+This function gives the block returned by :meth:`acquireBlock` back to the ring.
+
+Parameters
+----------
+    None
+
+Returns
+-------
+    None
+    
+        """
+        if self.ring:
+            self.ring.release()
+    
+
+    def getStreamStats(self):
+        """
+This function returns statistics of the ring started with :meth:`startStream`.
+
+Returns
+-------
+    dict:
+        | NumDropped: number of records dropped because the ring was full
+        | HighWater: maximum number of filled blocks
+        | NumFilled: currently filled blocks
+        | NumBlocks: number of blocks of the ring
+        | WrittenBytes, WriteStalls, WriteQueuePeak, WriteError: statistics of the ptu file written with `ptuPath`
+    
+        """
+        if not self.ring:
+            return {}
+        stats = {"NumDropped": self.ring.numDropped, "HighWater": self.ring.highWater, "NumFilled": self.ring.numFilled(), "NumBlocks": self.ring.numBlocks}
+        if self.writer:
+            stats.update({"WrittenBytes": self.writer.numBytes, "WriteStalls": self.writer.numStalls, "WriteQueuePeak": self.writer.peakQueue,
+                          "WriteError": str(self.writer.error) if self.writer.error else ""})
+        return stats
+    
+
+    def _stopStream(self):
+        if self.ring:
+            self.ring.stopProducer()
+        self.ring = None
+        if self.writer and not self.writer.close():
+            self.parent.logPrint(f"{Color.Red}Writing {self.writer.path} failed: {self.writer.error}")
+        self.writer = None
+
+
+    def _ptuTags(self):
+        isT3 = self.parent.deviceConfig["MeasMode"] == MeasMode.T3.value
+        syncRate = int(self.parent.getCountRates()[0])
+        if isT3:
+            globalRes = 1 / syncRate if syncRate else 0.0
+        else:
+            globalRes = self.parent.deviceConfig["BaseResolution"] * 1e-12
+        return {
+            "File_GUID": "{" + str(uuid.uuid4()).upper() + "}",
+            "CreatorSW_Name": "snAPI",
+            "Measurement_Mode": 3 if isT3 else 2,
+            "Measurement_SubMode": 0,
+            "TTResultFormat_TTTRRecType": recordType(self.parent.deviceConfig.get("Model", ""), isT3, self.parent.deviceConfig.get("Version", "")),
+            "TTResultFormat_BitsPerRecord": 32,
+            "MeasDesc_GlobalResolution": float(globalRes),
+            "MeasDesc_Resolution": self.parent.deviceConfig["Resolution"] * 1e-12,
+            "TTResult_SyncRate": syncRate,
+            "TTResult_NumberOfRecords": 0,
+        }
     
 
     def getData(self, numRead: typing.Optional[int] = None):
@@ -3002,8 +3366,7 @@ Example
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "getData is not supported for Raw class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return []
-        return np.lib.stride_tricks.as_strided(self.data, shape=(1, numRead),
-            strides=(ct.sizeof(self.data._type_) * numRead, ct.sizeof(self.data._type_)))[0]
+        return ctView(self.data, numRead)
     
 
     def numRead(self):
@@ -3071,6 +3434,8 @@ Example
             break
     
         """
+        if self.ring:
+            return self.finished.contents.value and not self.ring.running and self.ring.numFilled() == 0
         return self.finished.contents.value
         
 
@@ -3092,6 +3457,129 @@ Returns
         self.parent._stopMeasure()
     
 
+    def unfoldBlock(self, data):
+        """
+This function decodes a block of `Raw` data records into the `Unfold` format (see :class:`Unfold`) with numpy
+instead of record by record. The whole block is decoded at once: the overflow records are removed, and the
+overflow counts are accumulated over the overflow records only. The number of overflows is kept from one call
+to the next, so the blocks of :meth:`getBlock` or :meth:`acquireBlock` can be decoded one after the other.
+It is reset by :meth:`measure`, :meth:`startBlock` and :meth:`startStream`.
+
+Note
+----
+    The times of :obj:`.MeasMode.T3` records are nSync << 15 | dTime like in :class:`Unfold`. The times of
+    :obj:`.MeasMode.T2` records are converted to ps with the `BaseResolution` of the device.
+
+Parameters
+----------
+    data: 1DArray[uint32]
+        a block of `Raw` data records
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: 1DArray[uint64]
+            `Unfold` data array of timetags
+        channels: 1DArray[uint8]
+            `Unfold` data array of channel information
+
+Example
+-------
+::
+
+    # decodes the `Raw` blocks of a 10 s measurement in :obj:`.MeasMode.T2`
+    sn.raw.startBlock(10000)
+    while True:
+        finished = sn.raw.isFinished()
+        times, channels = sn.raw.unfoldBlock(sn.raw.getBlock())
+        ...
+        if finished:
+            break
+    
+        """
+        if self.decoder is None:
+            isT3 = self.parent.deviceConfig["MeasMode"] == MeasMode.T3.value
+            recType = recordType(self.parent.deviceConfig.get("Model", ""), isT3, self.parent.deviceConfig.get("Version", ""))
+            try:
+                self.decoder = RecordDecoder(recType, self.parent.deviceConfig["BaseResolution"] * 1e-12)
+            except ValueError as e:
+                self.parent.logPrint(f"{Color.Red}unfoldBlock: {e}")
+                return np.empty(0, dtype=np.uint64), np.empty(0, dtype=np.uint8)
+        return self.decoder.decodeNext(np.asarray(data, dtype=np.uint32))
+
+
+    def decodeBlock(self, data, channels=None, timeTags=None, dTimes=None, markers=None):
+        """
+This function decodes all fields of a block of `Raw` data records at once, like :meth:`channel`,
+:meth:`timeTag_T2` or :meth:`nSync_T3`, :meth:`dTime_T3` and :meth:`markers` do for a single record. The results
+are written into the given arrays, so they can be allocated once and reused for every block. Missing arrays are
+allocated. Only the fields that are needed have to be requested, the others are skipped with `False`.
+
+Parameters
+----------
+    data: 1DArray[uint32]
+        a block of `Raw` data records
+    channels: 1DArray[uint8] | bool (default: None - allocate)
+        output of :meth:`channel` (the special code + 1 for special records)
+    timeTags: 1DArray[uint32] | bool (default: None - allocate)
+        output of :meth:`timeTag_T2` in :obj:`.MeasMode.T2` or :meth:`nSync_T3` in :obj:`.MeasMode.T3`
+    dTimes: 1DArray[uint16] | bool (default: None - allocate)
+        output of :meth:`dTime_T3` (only in :obj:`.MeasMode.T3`)
+    markers: 1DArray[uint8] | bool (default: None - allocate)
+        output of the marker bits of marker records (bit 0 - 3: marker 1 - 4, 0: no marker record)
+
+Returns
+-------
+    tuple [1DArray, 1DArray, 1DArray, 1DArray]
+        channels, timeTags, dTimes, markers: views of the output arrays with the length of `data`
+        (None if not requested)
+
+Example
+-------
+::
+
+    # decodes the channels and the dTimes of all `Raw` T3 blocks into the same arrays
+    channels = np.empty(1024*1024, dtype=np.uint8)
+    dTimes = np.empty(1024*1024, dtype=np.uint16)
+    sn.raw.startBlock(10000, 1024*1024)
+    while not sn.raw.isFinished():
+        data = sn.raw.getBlock()
+        chans, _, dts, _ = sn.raw.decodeBlock(data, channels, False, dTimes, False)
+        ...
+    
+        """
+        data = np.asarray(data, dtype=np.uint32)
+        num = len(data)
+        isT3 = self.parent.deviceConfig["MeasMode"] == MeasMode.T3.value
+
+        def output(out, dtype):
+            if out is False or (out is None and dtype is None):
+                return None
+            if out is None:
+                out = np.empty(num, dtype=dtype)
+            return out[:num]
+
+        code = None
+        channels = output(channels, np.uint8)
+        markers = output(markers, np.uint8)
+        if channels is not None or markers is not None:
+            code = np.right_shift(data, 25)
+        if channels is not None:
+            np.bitwise_and(code, 0x3F, out=channels, casting='unsafe')
+            channels += 1
+        timeTags = output(timeTags, np.uint32)
+        if timeTags is not None:
+            np.bitwise_and(data, 0x3FF if isT3 else 0x1FFFFFF, out=timeTags, casting='unsafe')
+        dTimes = output(dTimes, np.uint16 if isT3 else None)
+        if dTimes is not None:
+            np.bitwise_and(np.right_shift(data, 10), 0x7FFF, out=dTimes, casting='unsafe')
+        if markers is not None:
+            # marker records are special records with the codes 1 - 15
+            np.bitwise_and(code, 0x0F, out=markers, casting='unsafe')
+            markers[(code & 0x70) != 0x40] = 0
+        return channels, timeTags, dTimes, markers
+
+
     def isSpecial(self, data: int) :
         """
 This function takes a T2 or T3 `Raw` data record and returns `True` if it is a special record.
@@ -3322,6 +3810,9 @@ There are special functions to decode the channel information:
         self.channels = ct.ARRAY(ct.c_uint8, 0)()
         self.idx = ct.pointer(ct.c_uint64(0))
         self.finished = ct.pointer(ct.c_bool(False))
+        self.ring = None
+        self.split = None
+        self.splitRead = None
 
     def measure(self, acqTime: typing.Optional[int] = 1000, size: typing.Optional[int] = 134217728, waitFinished: typing.Optional[bool] = True, savePTU: typing.Optional[bool] = False):
         """
@@ -3376,13 +3867,14 @@ Example
     sn.unfold.measure(1000, 134217728, True, True)
     
         """
-        self.times = ct.ARRAY(ct.c_uint64, size)()
-        self.channels = ct.ARRAY(ct.c_uint8, size)()
+        self._stopStream()
+        self._resetSplit(0)
+        self.times = bufferPool.array(ct.c_uint64, size, "Unfold.times")
+        self.channels = bufferPool.array(ct.c_uint8, size, "Unfold.channels")
         self.idx = ct.pointer(ct.c_uint64(0))
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "measurement is not supported for Unfold class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
-        self.parent.dll.ufMeasure.restype = ct.c_bool
         return self.parent.dll.ufMeasure(acqTime, waitFinished, savePTU, ct.byref(self.times), ct.byref(self.channels), self.idx, ct.c_uint64(size), self.finished)
     
 
@@ -3438,14 +3930,15 @@ Example
             sn.logPrint(f"{sn.unfold.numRead()} records read")
     
         """
-        self.storeTimes = ct.ARRAY(ct.c_uint64, size)()
-        self.storeChannels = ct.ARRAY(ct.c_uint8, size)()
-        self.times = ct.ARRAY(ct.c_uint64, size)()
-        self.channels = ct.ARRAY(ct.c_uint8, size)()
+        self._stopStream()
+        self._resetSplit(None)
+        self.storeTimes = bufferPool.array(ct.c_uint64, size, "Unfold.storeTimes")
+        self.storeChannels = bufferPool.array(ct.c_uint8, size, "Unfold.storeChannels")
+        self.times = bufferPool.array(ct.c_uint64, size, "Unfold.times")
+        self.channels = bufferPool.array(ct.c_uint8, size, "Unfold.channels")
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "startBlock is not supported for Unfold class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
-        self.parent.dll.ufStartBlock.restype = ct.c_bool
         return self.parent.dll.ufStartBlock(acqTime, savePTU, ct.byref(self.storeTimes), ct.byref(self.storeChannels), ct.c_uint64(size), self.finished)
     
 
@@ -3488,70 +3981,266 @@ Example
         else:
             self.parent.dll.ufGetBlock(ct.byref(self.times), ct.byref(self.channels), size)
             self.idx.contents.value = size.contents.value
-        return self.getData()
-    
+        times, channels = self.getData()
+        if self.split is not None:
+            self.split.append(times, channels)
+        return times, channels
 
-    def getData(self, numRead: typing.Optional[int] = None):
+
+    def startStream(self, acqTime: typing.Optional[int] = 1000, size: typing.Optional[int] = 8388608, numBlocks: typing.Optional[int] = 8,
+                    savePTU: typing.Optional[bool] = False, dropOnFull: typing.Optional[bool] = False, pollTime: typing.Optional[float] = 10):
         """
-This function returns the data of a measurement.
+This function starts a block-wise measurement like :meth:`startBlock`, but the blocks are collected in a ring
+of `numBlocks` blocks by a separate thread. The blocks are written directly into the ring and handed out by
+:meth:`acquireBlock` as views onto the ring memory, so they can be kept without a further copy and a slow
+reader does not lose the data of the last block. After processing a block it has to be given back with :meth:`releaseBlock`.
 
+If the ring is full the thread waits until a block is released (backpressure). With `dropOnFull` the block
+is discarded instead and the number of lost records is counted in :meth:`getStreamStats`.
 
-Note
-----
-    This function is also used as part a of the :meth:`getBlock` function.
+Warning
+-------
+    If the ring stays full for a longer time, the internal store of the API runs over as it does for
+    :meth:`startBlock` ('WRN UfStore buffer overrun - clearing!'). Use more or larger blocks in this case.
 
 Parameters
 ----------
-    numRead: int (default: None)
-        number of data to read (default: all data available)
-        
+    acqTime: int (default: 1s)
+        | 0: means the measurement will run until :meth:`stopMeasure`
+        | acquisition time [ms]
+        | will be ignored if device is a FileDevice
+    size: int number of records (default: 8 million records = 72MB)
+        size of one block
+    numBlocks: int (default: 8)
+        number of blocks in the ring
+    savePTU: bool (default: False)
+        Save data to ptu file
+    dropOnFull: bool (default: False)
+        | True: drop blocks if the ring is full and count them
+        | False: wait until the consumer releases a block
+    pollTime: float (default: 10ms)
+        time between two block reads of the ring thread [ms]
+
 Returns
 -------
-    tuple [1DArray, 1DArray]
-        times: 1DArray[int]
-            `Unfold` data array of timetags
-        channels: 1DArray[int]
-            `Unfold` data array of channel information
-
+    True: operation successful
+    False: operation failed
 
 Example
 -------
 ::
 
-    # reads `Unfold` data every second for 10 seconds in :obj:`.MeasMode.T3`  
-    sn = snAPI()
-    sn.getDevice()
-    sn.initDevice(MeasMode.T3)
-    sn.unfold.startBlock(10000)
-    while not sn.unfold.isFinished():
-        time.sleep(1)
-        times, channels = sn.unfold.getBlock()
-        if sn.unfold.numRead():
-            sn.logPrint(f"{sn.unfold.numRead()} records read")
+    # reads `Unfold` data for 10 seconds in :obj:`.MeasMode.T2` without copying the blocks
+    sn.unfold.startStream(10000)
+    while True:
+        finished = sn.unfold.isFinished()
+        times, channels = sn.unfold.acquireBlock()
+        if len(times):
+            ...
+        sn.unfold.releaseBlock()
+        if finished:
+            break
     
         """
-        if not numRead:
-            numRead = self.numRead()
-        return self.getTimes(numRead), self.getChannels(numRead)
+        self._stopStream()
+        self._resetSplit(None)
+        if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
+            self.parent.logPrint( "startStream is not supported for Unfold class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
+            return False
+        self.storeTimes = bufferPool.array(ct.c_uint64, size, "Unfold.storeTimes")
+        self.storeChannels = bufferPool.array(ct.c_uint8, size, "Unfold.storeChannels")
+        if not self.parent.dll.ufStartBlock(acqTime, savePTU, ct.byref(self.storeTimes), ct.byref(self.storeChannels), ct.c_uint64(size), self.finished):
+            return False
+        self.ring = BlockRing([ct.c_uint64, ct.c_uint8], size, numBlocks)
+        
+        def fetch(ptrs):
+            length = ct.pointer(ct.c_uint64(0))
+            self.parent.dll.ufGetBlock(ptrs[0], ptrs[1], length)
+            return length.contents.value
+        
+        self.ring.startProducer(fetch, lambda: self.finished.contents.value, pollTime, dropOnFull)
+        return True
     
 
-    def getTimes(self, numRead: int):
+    def acquireBlock(self):
         """
-This function returns an arrays holding the timetags of an `Unfold` measurement.
-
-Note
-----
-    This function is part of the :meth:`getData` function.
+This function returns the oldest block of the ring started with :meth:`startStream` as views onto the ring memory.
+The views stay valid until :meth:`releaseBlock` is called.
 
 Parameters
 ----------
-    numRead: int (default: None)
-        number of data to read (default: all data available)
-        
+    None
+
 Returns
 -------
-    times: 1DArray[int]
-        `Unfold` data array of timetags
+    tuple [1DArray, 1DArray]
+        times: 1DArray[int]
+            `Unfold` data array of timetags (empty if no block is available)
+        channels: 1DArray[int]
+            `Unfold` data array of channel information (empty if no block is available)
+    
+        """
+        block = self.ring.acquire() if self.ring else None
+        if block is None:
+            self.idx.contents.value = 0
+            return np.empty(0, dtype=np.uint64), np.empty(0, dtype=np.uint8)
+        self.idx.contents.value = len(block[0])
+        if self.split is not None:
+            self.split.append(block[0], block[1])
+        return block[0], block[1]
+    
+
+    def releaseBlock(self):
+        """
+This function gives the block returned by :meth:`acquireBlock` back to the ring.
+
+Parameters
+----------
+    None
+
+Returns
+-------
+    None
+    
+        """
+        if self.ring:
+            self.ring.release()
+    
+
+    def getStreamStats(self):
+        """
+This function returns statistics of the ring started with :meth:`startStream`.
+
+Returns
+-------
+    dict:
+        | NumDropped: number of records dropped because the ring was full
+        | HighWater: maximum number of filled blocks
+        | NumFilled: currently filled blocks
+        | NumBlocks: number of blocks of the ring
+    
+        """
+        if not self.ring:
+            return {}
+        return {"NumDropped": self.ring.numDropped, "HighWater": self.ring.highWater, "NumFilled": self.ring.numFilled(), "NumBlocks": self.ring.numBlocks}
+    
+
+    def _stopStream(self):
+        if self.ring:
+            self.ring.stopProducer()
+        self.ring = None
+    
+
+    def readFile(self, path: str, startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None,
+                 cache: typing.Union[bool, str] = False):
+        """
+This function reads the `Unfold` data of a time range of a ptu file without a measurement. The file is
+memory-mapped by a :class:`snAPI.Utils.PTUFile`, and only the records of the time range are decoded. The overflow
+index of the file is built at every call by scanning the file. If many windows are read from a large file, cache
+the index with `cache`, then it is only built at the first call.
+
+Parameters
+----------
+    path: str
+        path of the ptu file
+    startTime: float (default: None - start of the file)
+        start of the time range [s]
+    stopTime: float (default: None - end of the file)
+        end of the time range [s]
+    cache: bool or str (default: False - the index is not stored)
+        | True: the index is stored next to the file ('<file>.idx.npz')
+        | str: directory the index is stored in
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: 1DArray[int]
+            `Unfold` data array of timetags
+        channels: 1DArray[int]
+            `Unfold` data array of channel information
+    None: the file could not be read
+
+Example
+-------
+::
+
+    # reads 100 ms of data from the 10th second of a file
+    times, channels = sn.unfold.readFile(r"C:\Data\PicoQuant\default.ptu", 10.0, 10.1, cache=True)
+    
+        """
+        try:
+            file = PTUFile(path)
+            file.buildIndex(cache=cache)
+        except Exception as e:
+            self.parent.logPrint(f"{Color.Red}Can't read file \"{path}\": {e}")
+            return None
+        startPs = startTime * 1e12 if startTime is not None else None
+        stopPs = stopTime * 1e12 if stopTime is not None else None
+        first, end = file.blockRange(startPs, stopPs)
+        return file.decodeBlocks(first, end, startPs, stopPs)
+
+
+    def getData(self, numRead: typing.Optional[int] = None):
+        """
+This function returns the data of a measurement.
+
+
+Note
+----
+    This function is also used as part a of the :meth:`getBlock` function.
+
+Parameters
+----------
+    numRead: int (default: None)
+        number of data to read (default: all data available)
+        
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: 1DArray[int]
+            `Unfold` data array of timetags
+        channels: 1DArray[int]
+            `Unfold` data array of channel information
+
+
+Example
+-------
+::
+
+    # reads `Unfold` data every second for 10 seconds in :obj:`.MeasMode.T3`  
+    sn = snAPI()
+    sn.getDevice()
+    sn.initDevice(MeasMode.T3)
+    sn.unfold.startBlock(10000)
+    while not sn.unfold.isFinished():
+        time.sleep(1)
+        times, channels = sn.unfold.getBlock()
+        if sn.unfold.numRead():
+            sn.logPrint(f"{sn.unfold.numRead()} records read")
+    
+        """
+        if not numRead:
+            numRead = self.numRead()
+        return self.getTimes(numRead), self.getChannels(numRead)
+    
+
+    def getTimes(self, numRead: int):
+        """
+This function returns an arrays holding the timetags of an `Unfold` measurement.
+
+Note
+----
+    This function is part of the :meth:`getData` function.
+
+Parameters
+----------
+    numRead: int (default: None)
+        number of data to read (default: all data available)
+        
+Returns
+-------
+    times: 1DArray[int]
+        `Unfold` data array of timetags
 
 Example
 -------
@@ -3565,8 +4254,7 @@ Example
     times = sn.unfold.getTimes()
     
         """
-        return np.lib.stride_tricks.as_strided(self.times, shape=(1, numRead),
-            strides=(ct.sizeof(self.times._type_) * numRead, ct.sizeof(self.times._type_)))[0]
+        return ctView(self.times, numRead)
     
 
     def getChannels(self, numRead: int):
@@ -3600,8 +4288,7 @@ Example
     chans = sn.unfold.getChannels()
     
         """
-        return np.lib.stride_tricks.as_strided(self.channels, shape=(1, numRead),
-            strides=(ct.sizeof(self.channels._type_) * numRead, ct.sizeof(self.channels._type_)))[0]
+        return ctView(self.channels, numRead)
     
 
     def numRead(self):
@@ -3669,6 +4356,8 @@ Example
             break
     
         """
+        if self.ring:
+            return self.finished.contents.value and not self.ring.running and self.ring.numFilled() == 0
         return self.finished.contents.value
     
 
@@ -3690,6 +4379,46 @@ Returns
         self.parent._stopMeasure()
     
 
+    def setSplitChannels(self, enable: typing.Optional[bool] = True):
+        """
+This function switches the per-channel storage on or off. If it is on, the `Unfold` data is split by channel
+once when it arrives (:meth:`getBlock`, :meth:`acquireBlock` or the data of :meth:`measure`) into growable
+arrays of one channel each (see :class:`snAPI.Utils.ChannelStore`). :meth:`getTimesByChannel` then returns a
+view onto these arrays instead of scanning all data again for every channel. The memory needed grows with the
+number of events of each channel. In the block modes the times of all blocks are collected.
+
+Parameters
+----------
+    enable: bool (default: True)
+        | True: split the data by channel
+        | False: no per-channel storage
+
+Returns
+-------
+    None
+
+Example
+-------
+::
+
+    # gets the times of all channels of a 1 s measurement with one pass over the data
+    sn.unfold.setSplitChannels(True)
+    sn.unfold.measure(acqTime=1000, waitFinished=True)
+    times = [sn.unfold.getTimesByChannel(c) for c in range(1, sn.getNumAllChannels())]
+    
+        """
+        self.split = ChannelStore() if enable else None
+        if self.splitRead is not None:
+            # the data of :meth:`measure` is split again from the start
+            self.splitRead = 0
+
+
+    def _resetSplit(self, read):
+        if self.split is not None:
+            self.split.clear()
+        self.splitRead = read
+
+
     def getTimesByChannel(self, channel: int, size: typing.Optional[int] = None):
         """
 This function gives you the timetags of a given channel of the current measurement.
@@ -3700,6 +4429,7 @@ Parameters
         channel number starting at 0 for the sync channel and 1 for channel 1 
     size: int (default: None)
         number of data records to process (default: all data available)
+        | with :meth:`setSplitChannels` the maximum number of times returned
 
 Returns
 -------
@@ -3718,14 +4448,19 @@ Example
     times = sn.unfold.getTimesByChannel(1) # index 0 is the sync channel
     
         """
+        if self.split is not None:
+            if self.splitRead is not None:
+                numRead = self.numRead()
+                self.split.append(self.getTimes(numRead)[self.splitRead:], self.getChannels(numRead)[self.splitRead:])
+                self.splitRead = numRead
+            return self.split.view(channel)[:size]
         if not size:
             size = self.numRead()
         timesOut = ct.ARRAY(ct.c_uint64, size)()
         size = ct.pointer(ct.c_uint64(size))
         if size.contents.value > 0:
             self.parent.dll.getTimesFromChannelUF(ct.byref(self.channels), ct.byref(self.times), ct.byref(timesOut), channel, size)
-        return np.lib.stride_tricks.as_strided(timesOut, shape=(1, size.contents.value),
-            strides=(ct.sizeof(timesOut._type_) * size.contents.value, ct.sizeof(timesOut._type_)))[0]
+        return ctView(timesOut, size.contents.value)
     
 
     def isMarker(self, channel) :
@@ -3910,6 +4645,11 @@ to use the :obj:`.MeasMode.T2` instead.
         self.numBins = 0
         self.T2binWidth = 0
         self.bins = np.array(range(self.numBins), dtype='i8')
+        self.seq = 0
+        self.lastRaw = None
+        self.total = None
+        self.dirty = None
+        self.cleared = False
         
         self.finished = ct.pointer(ct.c_bool(False))
         
@@ -3948,7 +4688,6 @@ Example
         """
         if(self.parent.deviceConfig["MeasMode"] != MeasMode.T2.value):
             self.parent.logPrint( "setRefChannel is not supported in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
-        self.parent.dll.setHistoT2RefChan.argtypes = [ct.c_uint8]
         self.parent.dll.setHistoT2RefChan(channel)
 
 
@@ -3959,6 +4698,11 @@ This function sets the `binWidth` of the time differences for the histograms are
 Warning
 -------
     Only meaningful in :obj:`.MeasMode.T2`.
+
+Note
+----
+    The bins of the device have the same width and 32 bit counters. For logarithmic bins, 64 bit counters or
+    sparse histograms of many channels use :meth:`Pipeline.histogram` with `binEdges` and `pageSize`.
     
 Parameters
 ----------
@@ -3988,7 +4732,6 @@ Example
         if(self.parent.deviceConfig["MeasMode"] != MeasMode.T2.value):
             self.parent.logPrint( "setBinWidth is not supported in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
         self.T2binWidth = binWidth
-        self.parent.dll.setHistoT2BinWidth.argtypes = [ct.c_uint64]
         self.parent.dll.setHistoT2BinWidth(binWidth)
 
 
@@ -4044,7 +4787,10 @@ Example
         if self.T2binWidth == 0:
             self.T2binWidth = self.parent.deviceConfig["BaseResolution"]
         numChans = self.parent.getNumAllChannels()+2
-        self.data = ct.ARRAY(ct.c_long, numChans * self.numBins)(0)
+        self.data = bufferPool.array(ct.c_long, numChans * self.numBins, "Histogram.data", zero=True)
+        self.seq = 0
+        self.lastRaw = None
+        self.cleared = False
         
         self.bins = np.array(range(self.numBins), dtype='i8')
         if (self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
@@ -4054,7 +4800,6 @@ Example
         elif (self.parent.deviceConfig["MeasMode"] == MeasMode.T3.value):
             self.bins = np.multiply(self.bins, self.parent.deviceConfig["Resolution"])
             
-        self.parent.dll.getHistogram.restype = ct.c_bool
         return self.parent.dll.getHistogram(acqTime, waitFinished, savePTU, ct.byref(self.data), self.finished)
     
 
@@ -4098,9 +4843,95 @@ Example
         """
         self.numBins = self.parent.deviceConfig["NumBins"]
         numChans = self.parent.getNumAllChannels()
-        dataOut = np.lib.stride_tricks.as_strided(self.data, shape=(numChans, self.numBins),
-            strides=(ct.sizeof(self.data._type_) * self.numBins, ct.sizeof(self.data._type_)))
+        dataOut = ctView(self.data, (numChans, self.numBins))
         return dataOut, self.bins
+
+
+    def getSnapshot(self):
+        """
+This function returns a copy of the histograms with 64 bit counters. Other than :meth:`getData`, which returns a
+view of the buffer the device is writing to, the copy does not change while it is used. The counters of the
+device have 32 bits, their overflows are counted up between the calls. So call it at least once before a counter
+can overflow.
+
+Returns
+-------
+    tuple [2DArray, 1DArray, int]
+        histogram: 2DArray[int]
+            data array of counts
+        bins: 1DArray[int]
+            data array of bins [ps]
+        seq: int
+            sequence number of the read
+
+Example
+-------
+::
+
+    sn.histogram.measure(acqTime=0, waitFinished=False)
+    while True:
+        data, bins, seq = sn.histogram.getSnapshot()
+        ...
+
+        """
+        self._update()
+        return self.total.copy(), self.bins, self.seq
+
+
+    def getDelta(self):
+        """
+This function returns only the bins that changed since the last call of `getDelta` with their current counts.
+So a live view only has to copy and repaint what changed, and the sequence number tells which read it was.
+
+Returns
+-------
+    tuple [int, 1DArray, 1DArray, 1DArray]
+        seq: int
+            sequence number of the read
+        channels: 1DArray[int]
+            channels of the changed bins
+        bins: 1DArray[int]
+            indices of the changed bins
+        counts: 1DArray[int]
+            current counts (64 bit) of the changed bins
+
+Example
+-------
+::
+
+    sn.histogram.measure(acqTime=0, waitFinished=False)
+    data, bins, seq = sn.histogram.getSnapshot()
+    while True:
+        seq, chans, idx, counts = sn.histogram.getDelta()
+        data[chans, idx] = counts
+        ...
+
+        """
+        self._update()
+        channels, bins = np.nonzero(self.dirty)
+        self.dirty[:] = False
+        return self.seq, channels, bins, self.total[channels, bins]
+
+
+    def _update(self):
+        numChans = self.parent.getNumAllChannels()
+        numBins = self.parent.deviceConfig["NumBins"]
+        # an unsigned view of the device buffer with the width of its ctypes type unwraps the overflows of the counters
+        view = ctView(self.data, (numChans, numBins))
+        raw = view.view(np.dtype(f"u{view.itemsize}"))
+        if self.lastRaw is None or self.lastRaw.shape != raw.shape or self.cleared:
+            self.lastRaw = raw.copy()
+            self.total = self.lastRaw.astype(np.int64)
+            self.dirty = np.ones(raw.shape, dtype=bool)
+            self.cleared = False
+        else:
+            # only the changed bins are read and added, there is no copy of the whole buffer
+            changed = np.flatnonzero(raw != self.lastRaw)
+            current = raw.flat[changed]
+            self.total.flat[changed] += (current - self.lastRaw.flat[changed]).astype(np.int64)
+            self.lastRaw.flat[changed] = current
+            self.dirty.flat[changed] = True
+        self.seq += 1
     
 
     def stopMeasure(self):
@@ -4137,6 +4968,7 @@ Returns
     
         """
         self.parent._clearMeasure()
+        self.cleared = True
     
 
     def isFinished(self):
@@ -4255,6 +5087,7 @@ Warning
 Note
 ----
     The bin width can calculated as :math:`binWidth = historySize / numBins`.
+    To zoom between several history sizes without measuring again use :meth:`Pipeline.timeTracePyramid`.
 
 Parameters
 ----------
@@ -4274,7 +5107,6 @@ Example
     
         """
         self.historySize = historySize
-        self.parent.dll.setTimeTraceHistorySize.argtypes = [ct.c_double]
         self.parent.dll.setTimeTraceHistorySize(historySize)
         
 
@@ -4315,14 +5147,13 @@ Example
     
         """
         numChans = self.parent.getNumAllChannels()
-        self.data = ct.ARRAY(ct.c_long, numChans * self.numBins)(0)
+        self.data = bufferPool.array(ct.c_long, numChans * self.numBins, "TimeTrace.data", zero=True)
         
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "measure is not supported for TimeTrace class in MeasMode:", 
                 MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
         
-        self.parent.dll.getTimeTrace.restype = ct.c_bool
         return self.parent.dll.getTimeTrace(acqTime, waitFinished, savePTU, ct.byref(self.data), ct.byref(self.t0), self.finished)
     
 
@@ -4372,8 +5203,7 @@ Example
         """
         
         numChans = self.parent.getNumAllChannels()
-        dataOut = np.lib.stride_tricks.as_strided(self.data, shape=(numChans, self.numBins),
-            strides=(ct.sizeof(self.data._type_) * self.numBins, ct.sizeof(self.data._type_)))
+        dataOut = ctView(self.data, (numChans, self.numBins))
         if normalized:
             dataOut = np.multiply(dataOut, self.numBins/self.historySize)
         
@@ -4494,14 +5324,21 @@ multi-tau algorithm uses pseudo-logarithmically increasing bin widths.
         self.binWidth = 1000
         self.numBins = 0
         self.isFcs = False
+        self.matrix = None
+        self.engine = None
         self.finished = ct.pointer(ct.c_bool(False))
         
 
-    def setG2Parameters(self, startChannel: int, stopChannel: int, windowSize: float, binWidth: typing.Optional[float] = None):
+    def setG2Parameters(self, startChannel: int, stopChannel: int, windowSize: float, binWidth: typing.Optional[float] = None,
+                        numThreads: typing.Optional[int] = 1):
         """
 This function sets the the parameters for the g(2) correlation. If the `startChannel` is the same as the
 `stopChannel` an autocorrelation is performed and if the channels are different a
 cross calculation is done instead.
+With more than one of `numThreads` the correlation is calculated by a :class:`CorrelationConsumer` that splits
+the stop events of each block into batches for a pool of threads. Each thread needs an int32 histogram of the
+bins for the block. The threads only run in parallel in the numpy functions that release the GIL, so this is
+mainly useful for wide windows, and the speedup is well below `numThreads`.
 
 Note
 ----
@@ -4526,6 +5363,8 @@ Parameters
         size of the correlation window
     binWidth: int [ps]
         width of bins (Default: None - T2: BaseResolution, T3: Resolution) 
+    numThreads: int (default: 1)
+        number of correlation threads
 
 Returns
 -------
@@ -4538,6 +5377,9 @@ Example
     # sets the window size to 5000ps with a bin width of 5ps (that means 1000 bins will be calculated)
     sn.correlation.setG2Parameters(1, 2 , 5000, 5)
     
+    # correlates within 1us with 1ps bins on 8 threads
+    sn.correlation.setG2Parameters(1, 2 , 1e6, 1, numThreads=8)
+    
         """
         if binWidth is None:
             if self.parent.deviceConfig["MeasMode"] == MeasMode.T2.value:
@@ -4551,11 +5393,62 @@ Example
         self.binWidth = binWidth
         self.intervalLength = int(2 * windowSize / binWidth)
         self.isFcs = False
+        self.matrix = None
+        if numThreads and numThreads > 1:
+            self.matrix = CorrelationConsumer(self.parent, startChannel, stopChannel, windowSize, binWidth, numThreads)
+            return
         
-        self.parent.dll.setG2Params.argtypes = [ct.c_int, ct.c_int, ct.c_double, ct.c_double]
         self.parent.dll.setG2Params(startChannel, stopChannel, windowSize, binWidth)
     
 
+    def setG2Matrix(self, channels: typing.List[int], windowSize: float, binWidth: typing.Optional[float] = None,
+                    pairs: typing.Optional[typing.List[typing.Tuple[int, int]]] = None, numThreads: typing.Optional[int] = 1):
+        """
+This function sets the parameters for the g(2) correlations of many channel pairs at once. By default all pairs
+of the given `channels` (startChannel <= stopChannel, including the autocorrelations) are calculated in a
+single pass over the data stream by a :class:`G2MatrixConsumer`. The results of :meth:`getG2Data` then have the
+shape (pairs, bins) in the order of :obj:`pairs`.
+
+Note
+----
+    Each correlation is normalized with :eq:`g2factor`. The correlation of the reversed pair is the mirrored one.
+
+Parameters
+----------
+    channels: List[int] (0 is sync channel)
+        channels of the pairs
+    windowSize: float [ps]
+        size of the correlation window
+    binWidth: float [ps]
+        width of bins (Default: None - T2: BaseResolution, T3: Resolution) 
+    pairs: List[(int, int)] (default: None)
+        explicit list of (startChannel, stopChannel) pairs instead of all pairs of `channels`
+    numThreads: int (default: 1)
+        number of correlation threads (see :meth:`setG2Parameters`)
+
+Returns
+-------
+    List[(int, int)]:
+        the (startChannel, stopChannel) pairs in the order of the results
+
+Example
+-------
+::
+
+    # correlates all pairs of the channels 1 to 4 within 5000ps with a bin width of 5ps
+    pairs = sn.correlation.setG2Matrix([1, 2, 3, 4], 5000, 5)
+    sn.correlation.measure(10000, waitFinished=True)
+    data, bins = sn.correlation.getG2Data()
+    g2_1_3 = data[pairs.index((1, 3))]
+    
+        """
+        self.isFcs = False
+        self.windowSize = windowSize
+        self.matrix = G2MatrixConsumer(self.parent, channels, windowSize, binWidth, pairs, numThreads)
+        self.pairs = self.matrix.pairs
+        return self.pairs
+
+
     def setFCSParameters(self, startChannel: int, stopChannel: int, windowSize: typing.Optional[float] = 1e12, startTime: typing.Optional[float] = None, intervalLength: typing.Optional[int] = 8):
         """
 This function sets the the parameters for the FCS correlation. If the `startChannel` is the same as the
@@ -4612,6 +5505,7 @@ Example
                 startTime = self.parent.deviceConfig["Resolution"]
         
         self.isFcs = True 
+        self.matrix = None
         self.startChannel = startChannel
         self.stopChannel = stopChannel
         self.windowSize = windowSize
@@ -4620,7 +5514,6 @@ Example
 
         pNumTaus = ct.pointer(ct.c_int(0))
         
-        self.parent.dll.setFCSParams.argtypes = [ct.c_int, ct.c_int, ct.POINTER(ct.c_int), ct.c_int, ct.c_double, ct.c_double]
         self.parent.dll.setFCSParams(startChannel, stopChannel, pNumTaus, intervalLength, windowSize, startTime)
         self.numTaus = pNumTaus.contents.value
 
@@ -4681,6 +5574,7 @@ Example
                 startTime = self.parent.deviceConfig["Resolution"]
         
         self.isFcs = True 
+        self.matrix = None
         self.startChannel = startChannel
         self.stopChannel = stopChannel
         self.windowSize = windowSize
@@ -4689,10 +5583,64 @@ Example
 
         pNumTaus = ct.pointer(ct.c_int(0))
         
-        self.parent.dll.setFFCSParams.argtypes = [ct.c_int, ct.c_int, ct.POINTER(ct.c_int), ct.c_int, ct.c_double, ct.c_double]
         self.parent.dll.setFFCSParams(startChannel, stopChannel, pNumTaus, intervalLength, windowSize, startTime)
         self.numTaus = pNumTaus.contents.value
 
+    def setLiveFCS(self, startChannel: int, stopChannel: int, windowSize: typing.Optional[float] = 1e12, startTime: typing.Optional[float] = None,
+                   intervalLength: typing.Optional[int] = 8, segmentTime: typing.Optional[float] = None):
+        """
+This function sets the parameters for an incremental FCS correlation like :meth:`setFCSParameters`. The
+correlation is calculated by an :class:`FCSConsumer` level by level while the data arrives, so
+:meth:`getFCSData` returns the current correlation at any time without processing the old data again, and
+the memory used does not grow with the acquisition time. With `segmentTime` the partial correlations of
+consecutive segments can be read with :meth:`getFCSSegments`, e.g. to reject segments with bright bursts.
+
+Note
+----
+    The first level uses the lag times 1 to `intervalLength` times `startTime`, each further level doubles the
+    bin width and uses the lag times `intervalLength` / 2 + 1 to `intervalLength` times its bin width.
+
+Parameters
+----------
+    startChannel: int (0 is sync channel)
+        start channel
+    stopChannel: int (0 is sync channel)
+        click channel
+    windowSize: float [ps]
+        size of the correlation window
+    startTime: float [ps]
+        minimum tau (Default: None - T2: BaseResolution, T3: Resolution)
+    intervalLength: int
+        number of lag times per level (even)
+    segmentTime: float [ps] (default: None - no segments)
+        length of the segments of the partial correlations
+
+Returns
+-------
+    None
+
+Example
+-------
+::
+
+    # live FCS over 10 minutes with partial correlations of every 10 s
+    sn.correlation.setLiveFCS(1, 2, 1e12, 1e5, 8, segmentTime=10e12)
+    sn.correlation.measure(600000)
+    ...
+    data, taus, countRates, startTimes = sn.correlation.getFCSSegments()
+    good = countRates[:, 0] < 2 * np.median(countRates[:, 0])
+    average = data[good].mean(axis=0)
+    
+        """
+        self.isFcs = True
+        self.startChannel = startChannel
+        self.stopChannel = stopChannel
+        self.windowSize = windowSize
+        self.startTime = startTime
+        self.intervalLength = intervalLength
+        self.matrix = FCSConsumer(self.parent, startChannel, stopChannel, windowSize, startTime, intervalLength, segmentTime)
+
+
     def measure(self, acqTime: typing.Optional[int] = 1000, waitFinished: typing.Optional[bool] = False, savePTU: typing.Optional[bool] = False):
         """
 With this function a simple `Correlation` measurement is initiated. The results are stored into
@@ -4738,19 +5686,24 @@ Example
         
         """
         
+        if self.matrix:
+            self.engine = Pipeline(self.parent)
+            self.engine.chain = self.parent.manipulators.chain
+            self.engine.attach(self.matrix)
+            return self.engine.start(acqTime, waitFinished, savePTU)
+        
         if self.isFcs:
             self.numBins = self.numTaus
-            self.data = ct.ARRAY(ct.c_double, 2 * self.numBins)(0)
+            self.data = bufferPool.array(ct.c_double, 2 * self.numBins, "Correlation.data", zero=True)
         else:
             self.numBins = self.intervalLength
-            self.data = ct.ARRAY(ct.c_double, self.numBins)(0)
+            self.data = bufferPool.array(ct.c_double, self.numBins, "Correlation.data", zero=True)
             
         self.bins = ct.ARRAY(ct.c_double, self.numBins)(0) 
         if(self.parent.deviceConfig["MeasMode"] == MeasMode.Histogram.value):
             self.parent.logPrint( "measurement is not supported for Correlation class in MeasMode:", MeasMode(self.parent.deviceConfig["MeasMode"]).name)
             return False
         
-        self.parent.dll.getCorrelation.restype = ct.c_bool
         return self.parent.dll.getCorrelation(acqTime, waitFinished, savePTU, ct.byref(self.data), ct.byref(self.bins), self.finished)
 
 
@@ -4766,7 +5719,8 @@ Returns
 -------
     tuple [1DArray, 1DArray]
         data: 1DArray[int]
-            data array of the normalized g(2) measurement :eq:`g2factor`
+            | data array of the normalized g(2) measurement :eq:`g2factor`
+            | 2DArray with the shape (pairs, bins) after :meth:`setG2Matrix`
         bins: 1DArray[int]
             data array of the start times of bins from the beginning of the measurement [s]
 
@@ -4799,7 +5753,9 @@ Example
     plt.show(block=True)
     
         """
-        return np.lib.stride_tricks.as_strided(self.data), np.lib.stride_tricks.as_strided(self.bins)
+        if self.matrix and not self.isFcs:
+            return self.matrix.getData()
+        return ctView(self.data), ctView(self.bins)
 
 
     def getFCSData(self):
@@ -4851,8 +5807,38 @@ Example
     plt.show(block=True)    
     
         """
-        return np.lib.stride_tricks.as_strided(self.data, shape=(2, self.numBins),
-            strides=(ct.sizeof(self.data._type_) * self.numBins, ct.sizeof(self.data._type_)))[:, 4:], np.lib.stride_tricks.as_strided(self.bins)[4:]
+        if self.matrix:
+            return self.matrix.getData()
+        return ctView(self.data, (2, self.numBins))[:, 4:], ctView(self.bins)[4:]
+
+
+    def getFCSSegments(self):
+        """
+This function returns the partial FCS correlations of the finished segments of the incremental FCS correlation
+(see :meth:`setLiveFCS` and :meth:`FCSConsumer.getSegments`).
+
+Parameters
+----------
+    None
+
+Returns
+-------
+    tuple [3DArray, 1DArray, 2DArray, 1DArray]
+        data: 3DArray[float]
+            FCS correlations with the shape (segments, 2, taus) (A->B | B->A)
+        taus: 1DArray[float]
+            lag times [s]
+        countRates: 2DArray[float]
+            count rates of the two channels with the shape (segments, 2) [1/s]
+        startTimes: 1DArray[float]
+            start times of the segments [s]
+    None: no incremental FCS correlation is set
+
+        """
+        if not isinstance(self.matrix, FCSConsumer):
+            self.parent.logPrint(f"{Color.Red}There is no incremental FCS correlation set, use setLiveFCS!")
+            return None
+        return self.matrix.getSegments()
 
 
     def stopMeasure(self):
@@ -4888,6 +5874,8 @@ Returns
     None
     
         """
+        if self.matrix:
+            self.matrix.clear()
         self.parent._clearMeasure()
 
 
@@ -4929,6 +5917,8 @@ Example
             break
     
         """
+        if self.matrix and self.engine:
+            return self.engine.isFinished()
         return self.finished.contents.value
 
 
@@ -5016,6 +6006,9 @@ Example
     def __init__(self, parent):
         self.parent = parent
         self.config = []
+        self.stages = []
+        """definitions of the manipulators in the order they were added (used by :meth:`compile`)"""
+        self.chain = None
 
     def getConfig(self):
         """
@@ -5067,6 +6060,10 @@ Warning
         """
     
         self.parent.dll.clearManis()
+        self.stages = []
+        if self.chain is not None and self.parent.pipeline.chain is self.chain:
+            self.parent.pipeline.chain = None
+        self.chain = None
         self.getConfig()
 
     def coincidence(self, chans: typing.List[int], windowTime: typing.Optional[float] = 1000, mode: typing.Optional[CoincidenceMode] = CoincidenceMode.CountAll, time: typing.Optional[CoincidenceTime] = CoincidenceTime.Last, keepChannels: typing.Optional[bool] = True):
@@ -5146,8 +6143,10 @@ Example
         channels = (ct.c_int * length)()
         for i in range(length):
             channels[i] = chans[i]
-        self.parent.dll.addMCoincidence.argtypes = [ct.c_void_p, ct.c_int, ct.c_double, ct.c_int, ct.c_int, ct.c_bool]
         chanOut = self.parent.dll.addMCoincidence(ct.pointer(channels), length, windowTime, mode.value, time.value, keepChannels)
+        self.stages.append({"Type": "Coincidence", "Index": len(self.stages), "Chans": list(chans), "WindowTime": windowTime, "Mode": mode,
+                            "Time": time, "KeepChannels": keepChannels, "Reads": list(chans), "Removes": [] if keepChannels else list(chans),
+                            "Outputs": [chanOut]})
         self.getConfig()
         return chanOut
     
@@ -5201,6 +6200,8 @@ Example
         for i in range(length):
             channels[i] = chans[i]
         chanOut = self.parent.dll.addMMerge(ct.pointer(channels), length, keepChannels)
+        self.stages.append({"Type": "Merge", "Index": len(self.stages), "Chans": list(chans), "KeepChannels": keepChannels,
+                            "Reads": list(chans), "Removes": [] if keepChannels else list(chans), "Outputs": [chanOut]})
         self.getConfig()
         return chanOut
     
@@ -5278,23 +6279,60 @@ Example
     
         """
 
-        self.parent.dll.addMDelay.argtypes = [ct.c_int, ct.c_double, ct.c_bool]
         chanOut = self.parent.dll.addMDelay(channel, delayTime, keepSourceChannel)
+        self.stages.append({"Type": "Delay", "Index": len(self.stages), "Channel": channel, "DelayTime": delayTime,
+                            "KeepSourceChannel": keepSourceChannel, "Reads": [channel], "Removes": [] if keepSourceChannel or chanOut == channel else [channel],
+                            "Outputs": [chanOut]})
         self.getConfig()
         return chanOut
 
 
-    def herald(self, herald:int, gateChans: typing.List[int], delayTime: typing.Optional[int] = 0, gateTime: typing.Optional[int] = 1000, inverted: typing.Optional[bool] = False, keepChannels: typing.Optional[bool] = True):
+    def getDelayStats(self):
         """
-This manipulator performs as heralded gate filter. You have to define from which channel the herald events
-will be taken and which channels will be filtered. Therefore it is been necessary to set the delay time and
-the gate time of the following gate accordingly.
+This function returns the queue statistics of the delay manipulators of the compiled chain (see :meth:`compile`).
+The delayed events wait in a ring buffer until the data stream has passed their new time, so the peak depth is
+about the count rate times the delay time.
 
-.. image:: _static/07_Herald.png
-    :width: 600px
-    :class: only-light
-        
-.. image:: _static/07_Herald_dark.png
+Parameters
+----------
+    None
+
+Returns
+-------
+    List[dict]:
+        | one entry per delay manipulator with the keys
+        | "Index": index of the manipulator
+        | "Depth": number of events that are waiting
+        | "PeakDepth": maximum number of events that were waiting at once
+    None: the manipulators are not compiled
+
+Example
+-------
+::
+
+    cd = sn.manipulators.delay(1, 1e9)
+    sn.manipulators.compile()
+    sn.pipeline.start(10000, waitFinished=True)
+    sn.logPrint(sn.manipulators.getDelayStats())
+    
+        """
+        if self.chain is None:
+            self.parent.logPrint(f"{Color.Red}The manipulators are not compiled!")
+            return None
+        return self.chain.getDelayStats()
+
+
+    def herald(self, herald:int, gateChans: typing.List[int], delayTime: typing.Optional[int] = 0, gateTime: typing.Optional[int] = 1000, inverted: typing.Optional[bool] = False, keepChannels: typing.Optional[bool] = True):
+        """
+This manipulator performs as heralded gate filter. You have to define from which channel the herald events
+will be taken and which channels will be filtered. Therefore it is been necessary to set the delay time and
+the gate time of the following gate accordingly.
+
+.. image:: _static/07_Herald.png
+    :width: 600px
+    :class: only-light
+        
+.. image:: _static/07_Herald_dark.png
     :width: 600px
     :class: only-dark
     
@@ -5375,8 +6413,12 @@ Example
         for i in range(length):
             channels[i] = gateChans[i]
         hChan = self.parent.dll.addMHerald(herald, ct.pointer(channels), len(channels), delayTime, gateTime, inverted, keepChannels)
+        outputs = list(range(hChan, hChan + len(channels))) if keepChannels else list(gateChans)
+        self.stages.append({"Type": "Herald", "Index": len(self.stages), "Herald": herald, "GateChans": list(gateChans), "DelayTime": delayTime,
+                            "GateTime": gateTime, "Inverted": inverted, "KeepChannels": keepChannels, "Reads": [herald] + list(gateChans),
+                            "Removes": [], "Outputs": outputs if keepChannels else []})
         self.getConfig()
-        return list(range(hChan, hChan + len(channels))) if keepChannels else gateChans
+        return outputs
 
 
     def countrate(self, windowTime: typing.Optional[float] = 1e11):
@@ -5436,8 +6478,8 @@ Example
 
         """
 
-        self.parent.dll.addMCountRate.argtypes = [ct.c_double]
         index = self.parent.dll.addMCountRate(windowTime)
+        self.stages.append({"Type": "CountRate", "Index": len(self.stages), "RateIndex": index, "WindowTime": windowTime, "Reads": None, "Removes": [], "Outputs": []})
         self.getConfig()
         return index
     
@@ -5465,10 +6507,3536 @@ Example
     CRs = sn.manipulators.GetCountrates(0)
     
         """
+        if self.chain is not None and self.parent.pipeline.activeChain is self.chain:
+            return self.chain.getCountrates(manipulatorIndex)
         numChans = self.parent.getNumAllChannels()
         countRates = ct.ARRAY(ct.c_int, numChans)()
         ok = self.parent.dll.getMCountRates(manipulatorIndex, countRates)
         # dataOut = np.lib.stride_tricks.as_strided(countRates, shape=(numChans),
         #     strides=(ct.sizeof(countRates._type_) * numChans))
         self.getConfig()
-        return np.lib.stride_tricks.as_strided(countRates)
\ No newline at end of file
+        return ctView(countRates)
+
+
+    def compile(self, outputChannels: typing.Optional[typing.List[int]] = None, chunkSize: typing.Optional[int] = 65536,
+                clearAPI: typing.Optional[bool] = False):
+        """
+This function compiles the manipulators into a :class:`ManipulatorChain` that runs in the :class:`Pipeline`.
+All stages are applied to each chunk of a block in one pass instead of letting every manipulator write and read
+a complete data stream, and the channels that are not needed anymore are removed as early as possible. The
+channel numbers and the indices of the count rate manipulators stay the same.
+
+The manipulators of the API stay defined, so the other measurement classes keep seeing the manipulated data
+stream. The live `Unfold` stream of the pipeline then already holds the channels of the manipulators, and the
+chain is only applied to the data of other sources (e.g. :meth:`Pipeline.startFile` or the `Raw` records of
+:meth:`Pipeline.start` with `decodeRaw`). With `clearAPI` the manipulators are removed from the API and the
+chain is applied to the live stream as well.
+
+Warning
+-------
+    With `clearAPI` only the :class:`Pipeline` applies the manipulators. The other measurement classes see the
+    unmanipulated data stream. Use :meth:`clearAll` to start a new chain.
+
+Parameters
+----------
+    outputChannels: List[int] (default: None - all channels)
+        channels that are used behind the chain (all others are removed as soon as no stage needs them)
+    chunkSize: int (default: 65536)
+        number of events that run through all stages at once
+    clearAPI: bool (default: False)
+        remove the manipulators from the API, so the chain also runs on the live stream of the pipeline
+
+Returns
+-------
+    ManipulatorChain
+
+Example
+-------
+::
+
+    # counts only the coincidences of the heralded channels in the pipeline
+    heraldChans = sn.manipulators.herald(0, [1, 2], 52000, 300, keepChannels=False)
+    ci = sn.manipulators.coincidence(heraldChans, 1000, keepChannels=False)
+    sn.manipulators.compile(outputChannels=[ci], clearAPI=True)
+    trace = sn.pipeline.timeTrace(1000, 10)
+    sn.pipeline.start(10000, waitFinished=True)
+    
+        """
+        self.chain = ManipulatorChain(self.parent, list(self.stages), outputChannels, chunkSize)
+        self.chain.inAPI = not clearAPI
+        if clearAPI:
+            self.parent.dll.clearManis()
+            self.getConfig()
+        self.parent.pipeline.chain = self.chain
+        return self.chain
+
+
+class ManipulatorChain():
+    """
+This is a compiled chain of the manipulators for the :class:`Pipeline`. It is created by :meth:`Manipulators.compile`
+from the manipulators defined with :class:`Manipulators` and gives the same channels as they do.
+
+The blocks of the pipeline are cut into chunks of `chunkSize` events, and every chunk runs through all stages
+of the chain before the next one is taken, so the chunk stays in the cache. Every stage hands a compacted chunk
+to the next one: the new events are inserted right into it, and the channels that are not needed by the stages
+behind it and are not requested as output are removed right after the last stage that reads them.
+
+Parameters
+----------
+    parent: snAPI
+        the snAPI object
+    stages: List[dict]
+        the definitions of the stages (see :obj:`Manipulators.stages`)
+    outputChannels: List[int] (default: None - all channels)
+        channels that are needed behind the chain
+    chunkSize: int (default: 65536)
+        number of events that run through the chain at once
+
+    """
+
+
+    def __init__(self, parent, stages: typing.List[dict], outputChannels: typing.Optional[typing.List[int]] = None,
+                 chunkSize: typing.Optional[int] = 65536):
+        self.parent = parent
+        self.stages = stages
+        self.chunkSize = chunkSize
+        self.pipeline = None
+        self.inAPI = False
+        """True if the manipulators are also defined in the API (see `clearAPI` of :meth:`Manipulators.compile`)"""
+        self.stats = [StageStats(f"{stage['Type']}[{stage['Index']}]") for stage in stages]
+        """:class:`snAPI.Utils.StageStats` of each stage (see :meth:`Pipeline.getStats`)"""
+        outs = [c for stage in stages for c in stage["Outputs"]]
+        self.numChans = max(outs) + 1 if outs else 0
+        """number of channels including the channels of the manipulators"""
+
+        # keep[i] are the channels that are needed behind stage i - 1 (keep[0] at the input)
+        needed = np.zeros(256, dtype=bool)
+        needed[0x80:] = True
+        if outputChannels is None:
+            needed[:] = True
+        else:
+            needed[outputChannels] = True
+        self.keep = [None] * (len(stages) + 1)
+        self.keep[-1] = needed.copy()
+        for i in reversed(range(len(stages))):
+            stage = stages[i]
+            if stage["Reads"] is None:
+                needed[:] = True
+            else:
+                needed[stage["Reads"]] = True
+            self.keep[i] = needed.copy()
+        for i, stage in enumerate(stages):
+            if stage["Removes"]:
+                self.keep[i + 1][stage["Removes"]] = False
+        self.clear()
+
+
+    def begin(self, pipeline):
+        self.pipeline = pipeline
+        self.stats = [StageStats(f"{stage['Type']}[{stage['Index']}]") for stage in self.stages]
+        self.clear()
+
+
+    def clear(self):
+        self.states = [{} for _ in self.stages]
+
+
+    def process(self, times, channels):
+        """
+This function runs a block of `Unfold` data through all stages and returns the manipulated block.
+
+        """
+        if not len(times):
+            return times, channels
+        parts = [self._run(times[i:i + self.chunkSize], channels[i:i + self.chunkSize])
+                 for i in range(0, len(times), self.chunkSize)]
+        return np.concatenate([p[0] for p in parts]), np.concatenate([p[1] for p in parts])
+
+
+    def flush(self):
+        """
+This function returns the events that are still held back by delay stages at the end of the stream.
+
+        """
+        return self._run(np.zeros(0, dtype=np.uint64), np.zeros(0, dtype=np.uint8), True)
+
+
+    def getCountrates(self, manipulatorIndex: int):
+        """
+This function returns the counts of the last complete window of a count rate stage like
+:meth:`Manipulators.getCountrates`.
+
+        """
+        for stage, state in zip(self.stages, self.states):
+            if stage["Type"] == "CountRate" and stage["RateIndex"] == manipulatorIndex:
+                counts = state.get("published", np.zeros(256, dtype=np.int64))
+                return counts[:max(self.numChans, self.pipeline.numChans if self.pipeline else 0)]
+        return np.zeros(0, dtype=np.int64)
+
+
+    def getDelayStats(self):
+        """
+This function returns the statistics of the queues of the delay stages.
+
+Returns
+-------
+    List[dict]:
+        | one entry per delay stage with the keys
+        | "Index": index of the manipulator
+        | "Depth": number of events that are waiting
+        | "PeakDepth": maximum number of events that were waiting at once
+
+        """
+        stats = []
+        for stage, state in zip(self.stages, self.states):
+            if stage["Type"] == "Delay":
+                delayed = state.get("queue")
+                stats.append({"Index": stage["Index"], "Depth": delayed.size if delayed else 0,
+                              "PeakDepth": delayed.peakDepth if delayed else 0})
+        return stats
+
+
+    def _run(self, times, channels, flush=False):
+        ps = self.pipeline.toPs(times)
+        block = self._compact(times, channels, ps, self.keep[0])
+        for i, stage in enumerate(self.stages):
+            start = time.perf_counter_ns()
+            numIn = len(block[0])
+            block = getattr(self, "_" + stage["Type"][0].lower() + stage["Type"][1:])(stage, self.states[i], *block, flush)
+            block = self._compact(*block, self.keep[i + 1])
+            self.stats[i].record(numIn, len(block[0]), time.perf_counter_ns() - start)
+        return block[0], block[1]
+
+
+    @staticmethod
+    def _compact(times, channels, ps, keep):
+        if keep.all():
+            return times, channels, ps
+        kept = keep[channels]
+        return times[kept], channels[kept], ps[kept]
+
+
+    @staticmethod
+    def _insert(times, channels, ps, newTimes, newChannel, newPs):
+        # the new events are sorted in after all events with the same time
+        pos = np.searchsorted(ps, newPs, 'right')
+        return np.insert(times, pos, newTimes), np.insert(channels, pos, newChannel), np.insert(ps, pos, newPs)
+
+
+    def _coincidence(self, stage, state, times, channels, ps, flush):
+        chans = stage["Chans"]
+        window = stage["WindowTime"]
+        none = np.iinfo(np.int64).min // 2
+        sel = np.flatnonzero(np.isin(channels, chans))
+        num = len(sel)
+        lastPs = state.setdefault("lastPs", np.full(len(chans), none, dtype=np.int64))
+        lastTimes = state.setdefault("lastTimes", np.zeros(len(chans), dtype=np.uint64))
+        lastOrds = state.setdefault("lastOrds", np.full(len(chans), -1, dtype=np.int64))
+        count = state.get("count", 0)
+        if not num:
+            return times, channels, ps
+        selPs = ps[sel]
+        selChans = channels[sel]
+        selTimes = times[sel]
+        latestPs = np.empty((len(chans), num), dtype=np.int64)
+        latestTimes = np.empty((len(chans), num), dtype=np.uint64)
+        latestOrds = np.empty((len(chans), num), dtype=np.int64)
+        for k, c in enumerate(chans):
+            # the latest event of each channel at every event (forward fill)
+            idx = np.maximum.accumulate(np.where(selChans == c, np.arange(num), -1))
+            has = idx >= 0
+            latestPs[k] = np.where(has, selPs[idx], lastPs[k])
+            latestTimes[k] = np.where(has, selTimes[idx], lastTimes[k])
+            latestOrds[k] = np.where(has, count + idx, lastOrds[k])
+            if has[-1]:
+                lastPs[k], lastTimes[k], lastOrds[k] = latestPs[k, -1], latestTimes[k, -1], latestOrds[k, -1]
+        found = np.flatnonzero((latestPs >= selPs - window).all(axis=0))
+        if stage["Mode"] == CoincidenceMode.CountOnce and len(found):
+            # the events of a coincidence are used only once
+            reset = state.get("reset", -1)
+            firstOrds = latestOrds.min(axis=0)
+            once = []
+            for i in found:
+                if firstOrds[i] > reset:
+                    once.append(i)
+                    reset = count + i
+            state["reset"] = reset
+            found = np.array(once, dtype=np.int64)
+        state["count"] = count + num
+        if not len(found):
+            return times, channels, ps
+        if stage["Time"] == CoincidenceTime.First:
+            first = latestPs[:, found].argmin(axis=0)
+            newPs = latestPs[first, found]
+            newTimes = latestTimes[first, found]
+        else:
+            newPs = selPs[found]
+            newTimes = selTimes[found]
+        return self._insert(times, channels, ps, newTimes, stage["Outputs"][0], newPs)
+
+
+    def _merge(self, stage, state, times, channels, ps, flush):
+        sel = np.flatnonzero(np.isin(channels, stage["Chans"]))
+        if not stage["KeepChannels"]:
+            channels = channels.copy()
+            channels[sel] = stage["Outputs"][0]
+            return times, channels, ps
+        return np.insert(times, sel + 1, times[sel]), np.insert(channels, sel + 1, stage["Outputs"][0]), np.insert(ps, sel + 1, ps[sel])
+
+
+    def _delay(self, stage, state, times, channels, ps, flush):
+        sel = channels == stage["Channel"]
+        delayedPs = ps[sel] + int(round(stage["DelayTime"]))
+        if self.pipeline.measMode == MeasMode.T3:
+            delayedTimes = psToUnfold(delayedPs, True, self.pipeline.syncPeriod, self.pipeline.resolution)
+        else:
+            delayedTimes = delayedPs.astype(np.uint64)
+        if not stage["KeepSourceChannel"]:
+            times, channels, ps = times[~sel], channels[~sel], ps[~sel]
+        delayed = state.setdefault("queue", DelayQueue())
+        delayed.push(delayedPs, delayedTimes)
+        # the delayed events are held back until the stream has passed them
+        if flush:
+            releasedPs, releasedTimes = delayed.pop()
+        elif len(ps):
+            releasedPs, releasedTimes = delayed.pop(ps[-1])
+        else:
+            return times, channels, ps
+        if not len(releasedPs):
+            return times, channels, ps
+        return self._insert(times, channels, ps, releasedTimes, stage["Outputs"][0], releasedPs)
+
+
+    def _herald(self, stage, state, times, channels, ps, flush):
+        heralds = np.concatenate(([state.get("last", np.iinfo(np.int64).min // 2)], ps[channels == stage["Herald"]]))
+        if self.pipeline.measMode == MeasMode.T3:
+            # the dTimes of the events of one sync period are not strictly ordered, and gateIndex needs sorted heralds
+            heralds.sort()
+        state["last"] = heralds[-1]
+        if "outputOf" not in state:
+            # the output channel of every gated channel (-1: not gated)
+            state["outputOf"] = np.full(256, -1, dtype=np.int64)
+            state["outputOf"][stage["GateChans"]] = stage["Outputs"]
+        outputOf = state["outputOf"]
+        sel = np.flatnonzero(outputOf[channels] >= 0)
+        # all gated channels at once in one merge with the heralds
+        inside = gateIndex(heralds, ps[sel], stage["DelayTime"], stage["GateTime"]) >= 0
+        if stage["Inverted"]:
+            inside = ~inside
+        if not stage["KeepChannels"]:
+            kept = np.ones(len(times), dtype=bool)
+            kept[sel[~inside]] = False
+            return times[kept], channels[kept], ps[kept]
+        passed = sel[inside]
+        outputs = outputOf[channels[passed]].astype(np.uint8)
+        return np.insert(times, passed + 1, times[passed]), np.insert(channels, passed + 1, outputs), np.insert(ps, passed + 1, ps[passed])
+
+
+    def _countRate(self, stage, state, times, channels, ps, flush):
+        if not len(ps):
+            return times, channels, ps
+        windows = ps // int(stage["WindowTime"])
+        current = state.get("window", windows[0])
+        counts = state.get("counts", np.zeros(256, dtype=np.int64))
+        last = windows[-1]
+        if last > current:
+            inCurrent = windows == current
+            counts = counts + np.bincount(channels[inCurrent], minlength=256)
+            if last - current > 1:
+                # the last complete window is inside this block
+                counts = np.bincount(channels[windows == last - 1], minlength=256)
+            state["published"] = counts
+            state["counts"] = np.bincount(channels[windows == last], minlength=256)
+        else:
+            state["counts"] = counts + np.bincount(channels, minlength=256)
+        state["window"] = last
+        return times, channels, ps
+
+
+
+class Pipeline():
+    """
+This is the `Pipeline` measurement class.
+
+The measurement classes :class:`Histogram`, :class:`TimeTrace`, :class:`Correlation` and :class:`Unfold`
+each start their own acquisition, so only one of them can run at a time. The pipeline starts a single
+`Unfold` acquisition instead (see :meth:`Unfold.startStream`) and passes every unfolded block to all
+attached consumers. This way a histogram, a time trace and a g(2) correlation can be calculated from
+the same photons at the same time.
+
+The consumers are created with :meth:`histogram`, :meth:`timeTrace`, :meth:`correlation` and :meth:`unfold`.
+Each of them can optionally run on its own worker thread. The results are read from the returned consumer
+objects with their `getData` functions.
+
+Note
+----
+    The :class:`Manipulators` are applied to the data stream before it reaches the pipeline, so the
+    manipulator channels can be used by the consumers as well.
+    If `savePTU` is set in :meth:`start`, the raw data stream is written to the ptu file by the API.
+
+Example
+-------
+::
+
+    # a histogram, a time trace and a g(2) correlation of the same measurement
+    sn = snAPI()
+    sn.getDevice()
+    sn.initDevice(MeasMode.T2)
+    
+    histo = sn.pipeline.histogram(refChannel=0, binWidth=5)
+    trace = sn.pipeline.timeTrace(numBins=1000, historySize=10)
+    g2 = sn.pipeline.correlation(1, 2, 50000, 100, threaded=True)
+    sn.pipeline.start(10000)
+    
+    while True:
+        finished = sn.pipeline.isFinished()
+        histoData, histoBins = histo.getData()
+        counts, times = trace.getData()
+        g2Data, g2Bins = g2.getData()
+        ...
+        if finished:
+            break
+
+    """
+
+
+    def __init__(self, parent):
+        self.parent = parent
+        self.consumers = []
+        self.workers = {}
+        self.thread = None
+        self.running = False
+        self.measMode = MeasMode.T2
+        """measurement mode of the data stream"""
+        self.baseResolution = 1.0
+        """base resolution of the device [ps]"""
+        self.resolution = 1.0
+        """resolution of the dTimes in :obj:`.MeasMode.T3` [ps]"""
+        self.numBins = 65536
+        """default number of histogram bins"""
+        self.stopRequested = False
+        self.syncPeriod = 0.0
+        """sync period used to calculate absolute times in :obj:`.MeasMode.T3` [ps]"""
+        self.numChans = 0
+        """number of channels of the data stream (see :meth:`snAPI.getNumAllChannels`)"""
+        self.chain = None
+        """:class:`ManipulatorChain` that is applied to each block before the consumers (see :meth:`Manipulators.compile`)"""
+        self.activeChain = None
+        self.apiUnfold = False
+        self.idleNs = 0
+        self.sourceStats = StageStats("Source")
+        self.consumerStats = {}
+        self.stream = None
+        self.commandQueue = queue.Queue()
+        self.commandLock = threading.Lock()
+        self.acceptCommands = False
+        self.commands = []
+        self.lastTime = 0
+
+
+    def attach(self, consumer, threaded: typing.Optional[bool] = False, queueSize: typing.Optional[int] = 16):
+        """
+This function attaches a consumer to the pipeline. A consumer is an object derived from :class:`PipelineConsumer`.
+This can be used to add your own processing to the pipeline.
+
+Note
+----
+    A threaded consumer gets a copy of each block through a queue of `queueSize` blocks. If the queue is full,
+    the pipeline waits for the consumer.
+
+Parameters
+----------
+    consumer: PipelineConsumer
+        the consumer
+    threaded: bool (default: False)
+        process the blocks on a separate worker thread
+    queueSize: int (default: 16)
+        number of blocks a threaded consumer can queue
+
+Returns
+-------
+    the consumer
+
+        """
+        if self.running:
+            self.parent.logPrint(f"{Color.Red}It is not allowed to attach a consumer while the pipeline is running!")
+            return None
+        self.consumers.append(consumer)
+        self.consumerStats[consumer] = StageStats(f"{type(consumer).__name__}[{len(self.consumers) - 1}]")
+        if threaded:
+            self.workers[consumer] = queue.Queue(queueSize)
+        return consumer
+
+
+    def detach(self, consumer):
+        """
+This function removes a consumer from the pipeline.
+
+Parameters
+----------
+    consumer: PipelineConsumer
+        the consumer
+
+Returns
+-------
+    None
+
+        """
+        if self.running:
+            self.parent.logPrint(f"{Color.Red}It is not allowed to detach a consumer while the pipeline is running!")
+            return
+        if consumer in self.consumers:
+            self.consumers.remove(consumer)
+        self.workers.pop(consumer, None)
+
+
+    def clearAll(self):
+        """
+This removes all consumers from the pipeline.
+
+Warning
+-------
+    It is not allowed to clear the consumers while the pipeline is running!
+
+        """
+        for consumer in list(self.consumers):
+            self.detach(consumer)
+
+
+    def histogram(self, refChannel: typing.Optional[int] = 0, binWidth: typing.Optional[float] = None, numBins: typing.Optional[int] = None, threaded: typing.Optional[bool] = False,
+                  binEdges = None, pageSize: typing.Optional[int] = None):
+        """
+This function attaches a :class:`HistogramConsumer` to the pipeline. The parameters are the same as for
+:meth:`Histogram.setRefChannel` and :meth:`Histogram.setBinWidth`. Other than the histograms of the device the
+counters have 64 bits, the bins can have any widths (`binEdges`) and the histograms can be stored sparse
+(`pageSize`).
+
+Parameters
+----------
+    refChannel: int (default: 0 sync channel)
+        the reference channel (only meaningful in :obj:`.MeasMode.T2`)
+    binWidth: float [ps] (default: None - T2: BaseResolution, T3: Resolution)
+        width of the bins
+    numBins: int (default: None - deviceConfig["NumBins"])
+        number of bins
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+    binEdges: 1DArray[float] (default: None - bins of binWidth)
+        edges of the bins [ps], e.g. from :func:`snAPI.Utils.logBinEdges`
+    pageSize: int (default: None - dense)
+        number of bins per page of the sparse storage
+
+Returns
+-------
+    HistogramConsumer
+
+Example
+-------
+::
+
+    # logarithmic bins from 100ps to 1ms of 64 channels stored sparse
+    hist = sn.pipeline.histogram(0, binEdges=logBinEdges(100, 1e9, 2000), pageSize=256)
+    sn.pipeline.start(10000, waitFinished=True)
+    channels, bins, counts = hist.getSparseData()
+
+        """
+        return self.attach(HistogramConsumer(self.parent, refChannel, binWidth, numBins, binEdges, pageSize), threaded)
+
+
+    def timeTrace(self, numBins: typing.Optional[int] = 10000, historySize: typing.Optional[float] = 10, threaded: typing.Optional[bool] = False):
+        """
+This function attaches a :class:`TimeTraceConsumer` to the pipeline. The parameters are the same as for
+:meth:`TimeTrace.setNumBins` and :meth:`TimeTrace.setHistorySize`.
+
+Parameters
+----------
+    numBins: int (default: 10000)
+        number of bins
+    historySize: float [s] (default: 10s)
+        time span of the time trace
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+
+Returns
+-------
+    TimeTraceConsumer
+
+        """
+        return self.attach(TimeTraceConsumer(self.parent, numBins, historySize), threaded)
+
+
+    def timeTracePyramid(self, binWidths: typing.Optional[typing.List[float]] = (1e-3, 1e-2, 1e-1, 1), numBins: typing.Optional[int] = 3600,
+                         threaded: typing.Optional[bool] = False):
+        """
+This function attaches a :class:`TimeTracePyramidConsumer` to the pipeline that holds time traces with several
+bin widths at once.
+
+Parameters
+----------
+    binWidths: List[float] [s] (default: 1ms, 10ms, 100ms, 1s)
+        bin widths of the levels (multiples of the finest one)
+    numBins: int (default: 3600)
+        number of bins of each level
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+
+Returns
+-------
+    TimeTracePyramidConsumer
+
+Example
+-------
+::
+
+    # zooms from the last second to the last hour
+    trace = sn.pipeline.timeTracePyramid()
+    sn.pipeline.start(0, waitFinished=False)
+    while True:
+        counts, times = trace.getData(span=1)
+        counts, times = trace.getData(span=3600)
+        ...
+
+        """
+        return self.attach(TimeTracePyramidConsumer(self.parent, binWidths, numBins), threaded)
+
+
+    def correlation(self, startChannel: int, stopChannel: int, windowSize: float, binWidth: typing.Optional[float] = None,
+                    threaded: typing.Optional[bool] = False, numThreads: typing.Optional[int] = 1):
+        """
+This function attaches a g(2) :class:`CorrelationConsumer` to the pipeline. The parameters are the same as for
+:meth:`Correlation.setG2Parameters`.
+
+Parameters
+----------
+    startChannel: int (0 is sync channel)
+        start channel
+    stopChannel: int (0 is sync channel)
+        click channel
+    windowSize: float [ps]
+        size of the correlation window
+    binWidth: float [ps] (default: None - T2: BaseResolution, T3: Resolution)
+        width of bins
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+    numThreads: int (default: 1)
+        number of threads that share the histogramming of each block
+
+Returns
+-------
+    CorrelationConsumer
+
+        """
+        return self.attach(CorrelationConsumer(self.parent, startChannel, stopChannel, windowSize, binWidth, numThreads), threaded)
+
+
+    def g2Matrix(self, channels: typing.List[int], windowSize: float, binWidth: typing.Optional[float] = None,
+                 pairs: typing.Optional[typing.List[typing.Tuple[int, int]]] = None, threaded: typing.Optional[bool] = False,
+                 numThreads: typing.Optional[int] = 1):
+        """
+This function attaches a :class:`G2MatrixConsumer` to the pipeline that calculates the g(2) correlations of
+many channel pairs in one pass.
+
+Parameters
+----------
+    channels: List[int]
+        channels for all pairs (startChannel <= stopChannel, including the autocorrelations)
+    windowSize: float [ps]
+        size of the correlation window
+    binWidth: float [ps] (default: None - T2: BaseResolution, T3: Resolution)
+        width of bins
+    pairs: List[(int, int)] (default: None)
+        explicit list of (startChannel, stopChannel) pairs instead of all pairs of `channels`
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+    numThreads: int (default: 1)
+        number of threads that share the histogramming of each block
+
+Returns
+-------
+    G2MatrixConsumer
+
+        """
+        return self.attach(G2MatrixConsumer(self.parent, channels, windowSize, binWidth, pairs, numThreads), threaded)
+
+
+    def heraldedG2(self, herald: int, gateChans: typing.List[int], delayTime: float, gateTime: float, windowSize: float,
+                   binWidth: typing.Optional[float] = None, pairs: typing.Optional[typing.List[typing.Tuple[int, int]]] = None,
+                   threaded: typing.Optional[bool] = False, numThreads: typing.Optional[int] = 1):
+        """
+This function attaches a :class:`HeraldedG2Consumer` to the pipeline that calculates the g(2) correlations of
+the heralded events and the heralded coincidence counts in one pass. The gate is the same as of
+:meth:`Manipulators.herald`, but no virtual channels are needed.
+
+Parameters
+----------
+    herald: int
+        the channel that contains the herald events
+    gateChans: List[int]
+        channels that are gated (up to 24)
+    delayTime: float [ps]
+        time between the herald event and the start of the gate
+    gateTime: float [ps]
+        length of the gate
+    windowSize: float [ps]
+        size of the correlation window
+    binWidth: float [ps] (default: None - T2: BaseResolution, T3: Resolution)
+        width of bins
+    pairs: List[(int, int)] (default: None - all pairs of the gateChans)
+        (startChannel, stopChannel) pairs of the g(2) correlations
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+    numThreads: int (default: 1)
+        number of threads that share the histogramming of each block
+
+Returns
+-------
+    HeraldedG2Consumer
+
+Example
+-------
+::
+
+    # heralded g(2) of the channels 1 and 2 and the heralded two-fold coincidences
+    hg2 = sn.pipeline.heraldedG2(0, [1, 2], 46000, 2000, 2000, 1, pairs=[(1, 2)])
+    sn.pipeline.start(10000, waitFinished=True)
+    data, bins = hg2.getData()
+    twoFold = hg2.getCounts([1, 2])
+
+        """
+        return self.attach(HeraldedG2Consumer(self.parent, herald, gateChans, delayTime, gateTime, windowSize, binWidth, pairs, numThreads), threaded)
+
+
+    def coincidenceMatrix(self, chans: typing.List[int], windowTime: typing.Optional[float] = 1000,
+                          mode: typing.Optional[CoincidenceMode] = CoincidenceMode.CountAll, threaded: typing.Optional[bool] = False):
+        """
+This function attaches a :class:`CoincidenceMatrixConsumer` to the pipeline that counts the coincidences of all
+combinations of the given channels.
+
+Parameters
+----------
+    chans: List[int]
+        channels (up to 24)
+    windowTime: float (default: 1000ps)
+        window size [ps]
+    mode: CoincidenceMode (default: CoincidenceMode.CountAll)
+        coincidence counting mode
+    threaded: bool (default: False)
+        count on a separate worker thread
+
+Returns
+-------
+    CoincidenceMatrixConsumer
+
+Example
+-------
+::
+
+    # counts all coincidences of 8 detectors within 1ns
+    matrix = sn.pipeline.coincidenceMatrix(list(range(1, 9)), 1000, CoincidenceMode.CountOnce)
+    sn.pipeline.start(10000, waitFinished=True)
+    counts = matrix.getData()
+    threeFold = matrix.getCounts([1, 2, 3])
+    
+        """
+        return self.attach(CoincidenceMatrixConsumer(self.parent, chans, windowTime, mode), threaded)
+
+
+    def flim(self, numPixels: int, numLines: int, pixelTime: typing.Optional[float] = None, lineStart: typing.Optional[int] = 1,
+             lineStop: typing.Optional[int] = 2, frame: typing.Optional[int] = 3, chans: typing.Optional[typing.List[int]] = None,
+             binning: typing.Optional[int] = 1, numBins: typing.Optional[int] = None, threaded: typing.Optional[bool] = False):
+        """
+This function attaches a :class:`FLIMConsumer` to the pipeline that builds a lifetime image in
+:obj:`.MeasMode.T3`: a dTime histogram of every pixel and channel. The pixels are defined by the markers of the
+scanner (see :meth:`Device.setMarkerEnable` and :meth:`Device.setMarkerEdges`).
+
+Parameters
+----------
+    numPixels: int
+        number of pixels per line
+    numLines: int
+        number of lines per frame
+    pixelTime: float [ps] (default: None - duration of the line / numPixels)
+        dwell time of a pixel
+    lineStart: int (default: 1)
+        marker (1..4) of the line start
+    lineStop: int (default: 2)
+        marker (1..4) of the line stop, 0: the line ends after numPixels * pixelTime
+    frame: int (default: 3)
+        marker (1..4) of the frame start, 0: the lines wrap around after numLines
+    chans: List[int] (default: None - all detector channels)
+        channels of the image
+    binning: int (default: 1)
+        number of dTime slots per bin
+    numBins: int (default: None - all dTimes of the sync period)
+        number of bins
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+
+Returns
+-------
+    FLIMConsumer
+
+Example
+-------
+::
+
+    # 512 x 512 pixels image with 4 dTimes per bin
+    sn.device.setMarkerEnable(1, 1, 1, 0)
+    flim = sn.pipeline.flim(512, 512, binning=4, chans=[1, 2])
+    sn.pipeline.start(10000, waitFinished=True)
+    cube = flim.getData() # [lines, pixels, channels, bins]
+    intensity = flim.getIntensity()
+
+        """
+        return self.attach(FLIMConsumer(self.parent, numPixels, numLines, pixelTime, lineStart, lineStop, frame, chans, binning, numBins), threaded)
+
+
+    def fcs(self, startChannel: int, stopChannel: int, windowSize: typing.Optional[float] = 1e12, startTime: typing.Optional[float] = None,
+            intervalLength: typing.Optional[int] = 8, segmentTime: typing.Optional[float] = None, threaded: typing.Optional[bool] = False):
+        """
+This function attaches an :class:`FCSConsumer` to the pipeline that calculates the FCS correlation of one
+channel pair incrementally.
+
+Parameters
+----------
+    startChannel: int (0 is sync channel)
+        start channel
+    stopChannel: int (0 is sync channel)
+        click channel
+    windowSize: float [ps]
+        size of the correlation window
+    startTime: float [ps] (default: None - T2: BaseResolution, T3: Resolution)
+        minimum tau
+    intervalLength: int (default: 8)
+        number of lag times per level (even)
+    segmentTime: float [ps] (default: None - no segments)
+        length of the segments of the partial correlations
+    threaded: bool (default: False)
+        calculate on a separate worker thread
+
+Returns
+-------
+    FCSConsumer
+
+        """
+        return self.attach(FCSConsumer(self.parent, startChannel, stopChannel, windowSize, startTime, intervalLength, segmentTime), threaded)
+
+
+    def unfold(self, size: typing.Optional[int] = 134217728, threaded: typing.Optional[bool] = False):
+        """
+This function attaches an :class:`UnfoldConsumer` to the pipeline that stores the `Unfold` data stream.
+
+Parameters
+----------
+    size: int (default: 128 million records)
+        maximum number of records to store
+    threaded: bool (default: False)
+        store on a separate worker thread
+
+Returns
+-------
+    UnfoldConsumer
+
+        """
+        return self.attach(UnfoldConsumer(self.parent, size), threaded)
+
+
+    def callback(self, onData=None, batchSize: typing.Optional[int] = None, timeSlice: typing.Optional[float] = None,
+                 onBins=None, binWidth: typing.Optional[float] = None, threaded: typing.Optional[bool] = False):
+        """
+This function attaches a :class:`CallbackConsumer` to the pipeline that pushes the data to callbacks, e.g. for
+feedback loops without polling.
+
+Parameters
+----------
+    onData: function(times, channels) (default: None)
+        called with the collected `Unfold` data
+    batchSize: int (default: None)
+        number of events that fire `onData`
+    timeSlice: float (default: None)
+        data time that fires `onData` [ps] (without `batchSize` and `timeSlice` every block fires)
+    onBins: function(time, counts) (default: None)
+        called with the start time [s] and the counts of all channels of every completed bin and of the last
+        bin at the end (see :class:`CallbackConsumer` for gaps)
+    binWidth: float (default: None)
+        width of the bins of `onBins` [ps]
+    threaded: bool (default: False)
+        call the callbacks on a separate worker thread
+
+Returns
+-------
+    CallbackConsumer
+
+Example
+-------
+::
+
+    # adjusts the trigger level from the count rate of channel 1 every 10ms
+    def onBins(time, counts):
+        rate = counts[1] / 0.01
+        ...
+
+    sn.pipeline.callback(onBins=onBins, binWidth=1e10)
+    sn.pipeline.start(0, pollTime=1)
+
+        """
+        return self.attach(CallbackConsumer(self.parent, onData, batchSize, timeSlice, onBins, binWidth), threaded)
+
+
+    def record(self, path: str, chunkSize: typing.Optional[int] = 1048576, numThreads: typing.Optional[int] = 2,
+               level: typing.Optional[int] = 1, threaded: typing.Optional[bool] = True):
+        """
+This function attaches a :class:`RecorderConsumer` to the pipeline that writes the `Unfold` data stream into a
+compressed, chunked and seekable container file ('.ttz'). The times are delta coded, so the files are usually
+several times smaller than ptu files of the same data. They are replayed with :meth:`startFile`.
+
+Parameters
+----------
+    path: str
+        path of the file
+    chunkSize: int (default: 1 million events)
+        number of events per chunk
+    numThreads: int (default: 2)
+        number of compression threads
+    level: int (default: 1)
+        zlib compression level (1: fastest, 9: smallest)
+    threaded: bool (default: True)
+        write on a separate worker thread
+
+Returns
+-------
+    RecorderConsumer
+
+Example
+-------
+::
+
+    # records a compressed file and replays the first 10s of it
+    recorder = sn.pipeline.record(r"C:\Data\PicoQuant\default.ttz")
+    sn.pipeline.start(3600000, waitFinished=True)
+    sn.pipeline.detach(recorder)
+    g2 = sn.pipeline.correlation(1, 2, 50000, 100)
+    sn.pipeline.startFile(r"C:\Data\PicoQuant\default.ttz", waitFinished=True, stopTime=10)
+
+        """
+        return self.attach(RecorderConsumer(self.parent, path, chunkSize, numThreads, level), threaded)
+
+
+    def exportColumnar(self, path: str, format: typing.Optional[str] = "arrow", rowGroupSize: typing.Optional[int] = 1048576,
+                       threaded: typing.Optional[bool] = True):
+        """
+This function attaches a :class:`ColumnarConsumer` to the pipeline that writes the `Unfold` data stream into an
+Arrow IPC or a Parquet file. The data is written in record batches during the measurement, and other tools can
+read the file directly (e.g. with memory-mapping) without any conversion in Python.
+
+Parameters
+----------
+    path: str
+        path of the file
+    format: str (default: "arrow")
+        | "arrow": Arrow IPC file
+        | "parquet": Parquet file
+    rowGroupSize: int (default: 1 million events)
+        number of events per record batch (row group)
+    threaded: bool (default: True)
+        write on a separate worker thread
+
+Returns
+-------
+    ColumnarConsumer
+
+Example
+-------
+::
+
+    # exports a ptu file into an Arrow IPC file and maps it
+    sn.pipeline.exportColumnar(r"C:\Data\PicoQuant\default.arrow")
+    sn.pipeline.startFile(r"C:\Data\PicoQuant\default.ptu", waitFinished=True)
+    
+    import pyarrow as pa
+    table = pa.ipc.open_file(pa.memory_map(r"C:\Data\PicoQuant\default.arrow")).read_all()
+
+        """
+        if format not in ("arrow", "parquet"):
+            self.parent.logPrint(f"{Color.Red}Unknown columnar format: {format}")
+            return None
+        try:
+            import pyarrow
+        except ImportError:
+            self.parent.logPrint(f"{Color.Red}exportColumnar needs the pyarrow package!")
+            return None
+        return self.attach(ColumnarConsumer(self.parent, path, format, rowGroupSize), threaded)
+
+
+    def start(self, acqTime: typing.Optional[int] = 1000, waitFinished: typing.Optional[bool] = False, savePTU: typing.Optional[bool] = False,
+              size: typing.Optional[int] = 8388608, numBlocks: typing.Optional[int] = 8, pollTime: typing.Optional[float] = 10,
+              decodeRaw: typing.Optional[bool] = False):
+        """
+This function starts the acquisition of the pipeline and the processing of all attached consumers.
+With `decodeRaw` the `Raw` stream of the device is acquired and decoded into blocks of `Unfold` data by
+:meth:`Raw.unfoldBlock` on the pipeline thread instead of using the unfold stage of the API. The records do not
+pass the manipulators of the API, so a compiled :obj:`chain` is always applied to them.
+
+Parameters
+----------
+    acqTime: int (default: 1s)
+        | 0: means the measurement will run until :meth:`stopMeasure`
+        | acquisition time [ms]
+        | will be ignored if device is a FileDevice
+    waitFinished: bool (default: False)
+        True: block execution until finished (will be False on acqTime = 0)
+    savePTU: bool (default: False)
+        Save data to ptu file
+    size: int (default: 8 million records)
+        size of one block of the stream (see :meth:`Unfold.startStream`)
+    numBlocks: int (default: 8)
+        number of blocks of the stream
+    pollTime: float (default: 10ms)
+        time between two block reads [ms]
+    decodeRaw: bool (default: False)
+        | True: acquire `Raw` records and decode them with numpy
+        | False: acquire `Unfold` data
+
+Returns
+-------
+    True: operation successful
+    False: operation failed
+
+Example
+-------
+::
+
+    sn.pipeline.start(acqTime=10000, waitFinished=True)
+    
+        """
+        if self.running:
+            self.parent.logPrint(f"{Color.Red}The pipeline is already running!")
+            return False
+        self._setStreamInfo()
+        stream = self.parent.raw if decodeRaw else self.parent.unfold
+        if not stream.startStream(acqTime, size, numBlocks, savePTU, False, pollTime):
+            return False
+        self.stream = stream
+        return self._run(self._streamSource(stream, pollTime), waitFinished and acqTime > 0, apiUnfold=not decodeRaw)
+
+
+    def startFile(self, path: typing.Optional[typing.Union[str, typing.List[str]]] = None, waitFinished: typing.Optional[bool] = False,
+                  numThreads: typing.Optional[int] = None, chunkSize: typing.Optional[int] = 1048576,
+                  startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None,
+                  prefetchSize: typing.Optional[int] = 268435456, cache: typing.Union[bool, str] = False,
+                  fileGap: typing.Optional[float] = 10.0):
+        """
+This function replays a ptu file through the pipeline much faster than real time. The file is memory-mapped by
+a :class:`snAPI.Utils.PTUFile` and the records are decoded in chunks on `numThreads` threads. The overflow index
+of the file gives the time offset every chunk starts with. So the chunks can be decoded independently, and the
+consumers get them in the right order. With `startTime` and `stopTime` only a part of the file is replayed, and
+only the records of this part are read.
+
+Compressed container files ('.ttz', see :meth:`record` and :func:`snAPI.Utils.compressPTU`) are replayed the
+same way by a :class:`snAPI.Utils.TTZFile`, with the compressed chunks as index blocks.
+
+A dataset of many files (e.g. the segments of a long measurement) is replayed back to back as one data stream
+if `path` is a list of files or a glob pattern (sorted by name, numbers by value). The consumers keep their
+state at the borders of the files, so e.g. a correlation also gets the pairs of events in two files whose times
+go on. If the times of a file start again at zero, the real time between the files is unknown. Then the file is
+shifted behind the end of the file before with a gap of `fileGap`. If the gap is larger than the longest
+correlation window or lag of the consumers, no pairs of events of the two files are counted. While a file is
+replayed, the index and the first `prefetchSize` bytes of the next file are read on an I/O thread, and only
+these two files are opened at a time.
+
+Note
+----
+    The :class:`Manipulators` of the API are not applied to the replayed data.
+
+Parameters
+----------
+    path: str or List[str] (default: None - the file of the current file device, see :meth:`snAPI.getFileDevice`)
+        path of the ptu or ttz file, a list of files or a glob pattern of a dataset
+    waitFinished: bool (default: False)
+        True: block execution until finished
+    numThreads: int (default: None - Workers of :meth:`snAPI.setThreadSettings` or the number of cpu cores)
+        number of decoding threads
+    chunkSize: int (default: 1 million records)
+        number of records per chunk (rounded to the index step of 65536 records)
+    startTime: float (default: None - start of the file)
+        start of the replayed part [s] (not for datasets)
+    stopTime: float (default: None - end of the file)
+        end of the replayed part [s] (not for datasets)
+    prefetchSize: int (default: 256MB)
+        number of bytes of the next file of a dataset that are read ahead
+    cache: bool or str (default: False - the index is built at every replay)
+        | True: the index of a ptu file is stored next to it ('<file>.idx.npz') and reused
+        | str: directory the index is stored in (e.g. if the data is on a read-only share)
+    fileGap: float (default: 10s)
+        gap in front of a file of a dataset whose times start again [s]
+
+Returns
+-------
+    True: operation successful
+    False: operation failed
+
+Example
+-------
+::
+
+    # calculates a g(2) correlation and a time trace of a file on all cores
+    g2 = sn.pipeline.correlation(1, 2, 50000, 100)
+    trace = sn.pipeline.timeTrace(1000, 100)
+    sn.pipeline.startFile(r"C:\Data\PicoQuant\default.ptu", waitFinished=True)
+    g2Data, g2Bins = g2.getData()
+
+    # one FCS over all segments of a session
+    fcs = sn.pipeline.fcs(1, 2, 1e12)
+    sn.pipeline.startFile(r"C:\Data\PicoQuant\session\*.ptu", waitFinished=True)
+    
+        """
+        if self.running:
+            self.parent.logPrint(f"{Color.Red}The pipeline is already running!")
+            return False
+        if path is None:
+            path = self.parent.deviceConfig.get("FileDevicePath", "")
+        self.stream = None
+        if not isinstance(path, str) or glob.has_magic(path):
+            if startTime is not None or stopTime is not None:
+                self.parent.logPrint(f"{Color.Red}A time range can only be replayed from a single file, not from a dataset!")
+                return False
+            return self._startDataset(path, waitFinished, numThreads or threadSettings.numWorkers(), chunkSize, prefetchSize, cache, fileGap)
+        try:
+            file = TTZFile(path) if path.lower().endswith(".ttz") else PTUFile(path)
+        except Exception as e:
+            self.parent.logPrint(f"{Color.Red}Can't replay file \"{path}\": {e}")
+            return False
+        self._setFileInfo(file)
+        startPs = startTime * 1e12 if startTime is not None else None
+        stopPs = stopTime * 1e12 if stopTime is not None else None
+        return self._run(self._fileSource(file, numThreads or threadSettings.numWorkers(), chunkSize, startPs, stopPs, cache=cache), waitFinished)
+
+
+    def feed(self, times, channels):
+        """
+This function passes a block of `Unfold` data directly to all attached consumers. It can be used to process data
+from other sources than the current device. The consumers have to be prepared with :meth:`begin` before and
+:meth:`end` has to be called after the last block. If a :obj:`chain` is set, the block runs through it first.
+
+Parameters
+----------
+    times: 1DArray[int]
+        `Unfold` data array of timetags
+    channels: 1DArray[int]
+        `Unfold` data array of channel information
+
+Returns
+-------
+    None
+
+        """
+        if self.activeChain is not None:
+            times, channels = self.activeChain.process(times, channels)
+        self._dispatch(times, channels)
+
+
+    def begin(self):
+        """
+This function prepares all consumers and starts the worker threads. It is called by :meth:`start` and is only
+needed together with :meth:`feed`.
+
+        """
+        self.threads = []
+        self.sourceStats = StageStats("Source")
+        self.consumerStats = {c: StageStats(f"{type(c).__name__}[{i}]") for i, c in enumerate(self.consumers)}
+        # the unfold stream of the API already holds the channels of the manipulators that are still in the API,
+        # the Raw records (decodeRaw) and the other sources do not
+        self.activeChain = None if self.chain is None or (self.apiUnfold and self.chain.inAPI) else self.chain
+        if self.activeChain is not None:
+            self.activeChain.begin(self)
+            self.numChans = max(self.numChans, self.activeChain.numChans)
+        for consumer in self.consumers:
+            consumer.begin(self)
+            if consumer in self.workers:
+                thread = threading.Thread(target=self._work, args=(consumer, self.workers[consumer]), daemon=True)
+                thread.start()
+                self.threads.append(thread)
+
+
+    def end(self):
+        """
+This function waits for the worker threads and finishes all consumers. It is called after the last block by
+:meth:`start` and is only needed together with :meth:`feed`.
+
+        """
+        if self.activeChain is not None:
+            times, channels = self.activeChain.flush()
+            if len(times):
+                self._dispatch(times, channels)
+        for consumer in self.consumers:
+            if consumer in self.workers:
+                self.workers[consumer].put(None)
+        for thread in self.threads:
+            thread.join()
+        self.threads = []
+        for consumer in self.consumers:
+            # a failing consumer must not keep the others from finishing (e.g. closing their files)
+            try:
+                consumer.end()
+            except Exception as e:
+                self.parent.logPrint(f"{Color.Red}Finishing {type(consumer).__name__} failed: {e}")
+
+
+    def isFinished(self):
+        """
+This function reports whether the pipeline is finished.
+
+Warning
+-------
+    If the pipeline is finished, the results are complete. It may be necessary to read the results of the
+    consumers once again after `isFinished` returns `True`.
+
+Returns
+-------
+    True: the pipeline is finished
+    False: the pipeline is running
+
+        """
+        return not self.running
+
+
+    def stopMeasure(self):
+        """
+This function stops the acquisition of the pipeline. The data that is already acquired will be processed completely.
+
+Returns
+-------
+    None
+
+        """
+        self.stopRequested = True
+        self.parent._stopMeasure()
+
+
+    def clearMeasure(self):
+        """
+This function clears the results of all consumers without stopping the acquisition.
+
+Returns
+-------
+    None
+
+        """
+        for consumer in self.consumers:
+            consumer.clear()
+
+
+    def toPs(self, times):
+        """
+This function converts `Unfold` timetags into absolute times in ps. In :obj:`.MeasMode.T3` the times are
+calculated from the sync counter and the dTime with the :obj:`syncPeriod` and the :obj:`resolution`.
+
+Parameters
+----------
+    times: 1DArray[int]
+        `Unfold` data array of timetags
+
+Returns
+-------
+    times: 1DArray[int]
+        absolute times [ps]
+
+        """
+        return unfoldToPs(times, self.measMode == MeasMode.T3, self.syncPeriod, self.resolution)
+
+
+    def _setStreamInfo(self):
+        self.measMode = MeasMode(self.parent.deviceConfig["MeasMode"])
+        self.baseResolution = self.parent.deviceConfig["BaseResolution"]
+        self.resolution = self.parent.deviceConfig["Resolution"]
+        self.numBins = self.parent.deviceConfig["NumBins"]
+        self.numChans = self.parent.getNumAllChannels()
+        self.syncPeriod = 0.0
+        if self.measMode == MeasMode.T3:
+            syncRate = self.parent.measDescription.get("AveSyncRate", 0) if len(self.parent.measDescription) else 0
+            if not syncRate:
+                syncRate = self.parent.getCountRates()[0]
+            if syncRate:
+                self.syncPeriod = 1e12 / syncRate
+
+
+    def _setFileInfo(self, file):
+        if isinstance(file, TTZFile):
+            isT3, baseResolution, self.numChans = file.isT3, file.baseResolution, file.numChans
+        else:
+            # in T2 the global resolution is the resolution of the timetags, in T3 it is the sync period
+            isT3, baseResolution = file.decoder.isT3, file.decoder.timeFactor
+            self.numChans = file.tags.get("HW_InpChannels", 64) + 1
+        self.measMode = MeasMode.T3 if isT3 else MeasMode.T2
+        self.resolution = file.resolution
+        self.baseResolution = self.resolution if isT3 else baseResolution
+        self.numBins = 32768 if isT3 else 65536
+        self.syncPeriod = file.syncPeriod
+
+
+    def _startDataset(self, paths, waitFinished, numThreads, chunkSize, prefetchSize, cache, fileGap):
+        if isinstance(paths, str):
+            # numbers in the names are sorted by value (default_2.ptu before default_10.ptu)
+            naturalKey = lambda p: [int(t) if t.isdigit() else t.lower() for t in re.split(r'(\d+)', p)]
+            paths = sorted(glob.glob(paths), key=naturalKey)
+        paths = list(paths)
+        if not paths:
+            self.parent.logPrint(f"{Color.Red}The dataset contains no files!")
+            return False
+        try:
+            file = self._openFile(paths[0], 0, cache)
+        except Exception as e:
+            # e.g. a truncated header or a damaged index
+            self.parent.logPrint(f"{Color.Red}Can't replay file \"{paths[0]}\": {e}")
+            return False
+        self._setFileInfo(file)
+        return self._run(self._datasetSource(file, paths, numThreads, chunkSize, prefetchSize, cache, fileGap), waitFinished)
+
+
+    def _openFile(self, path, prefetchSize, cache):
+        file = TTZFile(path) if path.lower().endswith(".ttz") else PTUFile(path)
+        file.buildIndex(cache=cache)
+        # reading the start of the file brings it into the cache of the operating system
+        with open(path, 'rb', buffering=0) as f:
+            chunk = bytearray(1 << 22)
+            numRead = 0
+            while numRead < prefetchSize and (n := f.readinto(chunk)):
+                numRead += n
+        return file
+
+
+    def _datasetSource(self, file, paths, numThreads, chunkSize, prefetchSize, cache, fileGap):
+        isT3 = self.measMode == MeasMode.T3
+        # the gap in the units of the timetags (T3: syncs)
+        if isT3:
+            gap = int(np.ceil(fileGap * 1e12 / self.syncPeriod)) if self.syncPeriod else 0
+        else:
+            gap = int(np.ceil(fileGap * 1e12))
+        last = -1
+        with concurrent.futures.ThreadPoolExecutor(1, initializer=workerInit) as io:
+            for i, path in enumerate(paths):
+                if i:
+                    try:
+                        file = nextFile.result()
+                    except Exception as e:
+                        self.parent.logPrint(f"{Color.Red}Can't replay file \"{path}\": {e}")
+                        return
+                if i + 1 < len(paths):
+                    nextFile = io.submit(self._openFile, paths[i + 1], prefetchSize, cache)
+                if (file.isT3 if isinstance(file, TTZFile) else file.decoder.isT3) != isT3 or file.resolution != self.resolution:
+                    self.parent.logPrint(f"{Color.Red}The file \"{path}\" has another measurement mode or resolution than the dataset!")
+                    return
+                offset = None
+                for times, channels in self._fileSource(file, numThreads, chunkSize, None, None, indexed=True):
+                    if offset is None:
+                        # a file that starts at zero again goes on behind the end of the file before and the gap
+                        # (T3: after whole syncs)
+                        offset = 0
+                        if int(times[0]) <= last:
+                            offset = ((last >> 15) + 1 + gap) << 15 if isT3 else last + 1 + gap
+                    if offset:
+                        times = times + np.uint64(offset)
+                    last = int(times[-1])
+                    yield times, channels
+                if self.stopRequested:
+                    return
+
+
+    def _fileSource(self, file, numThreads, chunkSize, startTime, stopTime, indexed=False, cache=False):
+        with concurrent.futures.ThreadPoolExecutor(numThreads, initializer=workerInit) as pool:
+            if not indexed:
+                file.buildIndex(pool, cache)
+            first, end = file.blockRange(startTime, stopTime)
+            step = max(chunkSize // file.indexStep, 1)
+            for roundStart in range(first, end, numThreads * step):
+                if self.stopRequested:
+                    break
+                # the index gives the number of overflows before every chunk
+                starts = range(roundStart, min(roundStart + numThreads * step, end), step)
+                decode = lambda b: file.decodeBlocks(b, min(b + step, end), startTime, stopTime)
+                for times, channels in pool.map(decode, starts):
+                    if len(times):
+                        yield times, channels
+
+
+    def _streamSource(self, stream, pollTime):
+        isRaw = stream is self.parent.raw
+        while True:
+            finished = stream.isFinished()
+            block = stream.acquireBlock()
+            if isRaw:
+                block = stream.unfoldBlock(block)
+            if len(block[0]):
+                yield block
+            stream.releaseBlock()
+            if finished:
+                break
+            if not len(block[0]):
+                self._idle(pollTime)
+                # an empty block lets the pipeline apply the queued commands while no data comes
+                yield block
+
+
+    def _idle(self, pollTime):
+        # the waiting of a source for new data is not part of the time of the Source stage
+        start = time.perf_counter_ns()
+        time.sleep(pollTime / 1000)
+        self.idleNs += time.perf_counter_ns() - start
+
+
+    def _run(self, source, waitFinished, apiUnfold=False):
+        self.apiUnfold = apiUnfold
+        self.idleNs = 0
+        self.begin()
+        self.stopRequested = False
+        self.lastTime = 0
+        self.commands = []
+        with self.commandLock:
+            self.commandQueue = queue.Queue()
+            self.acceptCommands = True
+        self.running = True
+
+        def run():
+            threadSettings.apply("Pipeline")
+            try:
+                while True:
+                    # the time of the source is the time to get (read and decode) the next block without the waiting
+                    start = time.perf_counter_ns() - self.idleNs
+                    block = next(source, None)
+                    if block is None:
+                        break
+                    if len(block[0]):
+                        self.sourceStats.record(len(block[0]), len(block[0]), time.perf_counter_ns() - self.idleNs - start)
+                        self.feed(*block)
+                        self.lastTime = int(block[0][-1])
+                    self._applyCommands()
+            finally:
+                try:
+                    # the commands that are queued later are run at once by queueCommand
+                    with self.commandLock:
+                        self.acceptCommands = False
+                    self._applyCommands()
+                    self.end()
+                finally:
+                    # isFinished() must also report the end of a pipeline that failed
+                    self.running = False
+
+        self.thread = threading.Thread(target=run, daemon=True)
+        self.thread.start()
+        if waitFinished:
+            self.thread.join()
+        return True
+
+
+    def queueCommand(self, function=None, args: typing.Optional[tuple] = (), label: typing.Optional[str] = ""):
+        """
+This function changes parameters during a running acquisition without stopping it. The command (`function(*args)`,
+e.g. a setting of :class:`Device` or of a consumer) is queued and run by the pipeline thread between two blocks.
+So all data before it was processed with the old parameters and all data after it with the new ones. At this
+point the :meth:`PipelineConsumer.onCommand` of all consumers is called with the time of the last event, in the
+order of the data (also for threaded consumers). No event is inserted into the data stream, so the marker
+channels stay untouched. The applied commands are listed by :meth:`getCommands`. If the pipeline is not running, the command is run at once.
+
+Note
+----
+    The data that is already acquired by the device but not yet processed belongs to the block before the
+    command. The point of the change in the input data is therefore a little later (up to the size of the
+    buffers of the API) than the time of the command.
+
+Parameters
+----------
+    function: function (default: None - only the notification of the consumers)
+        the command
+    args: tuple (default: ())
+        arguments of the command
+    label: str (default: "")
+        name of the command (passed to the consumers)
+
+Returns
+-------
+    None
+
+Example
+-------
+::
+
+    # a trigger level sweep in one acquisition
+    trace = sn.pipeline.timeTrace(1000, 100)
+    sn.pipeline.start(0)
+    for level in range(-500, 0, 10):
+        sn.pipeline.queueCommand(sn.device.setInputEdgeTrig, (-1, level, 0), f"level {level}")
+        time.sleep(0.1)
+    sn.pipeline.stopMeasure()
+    commands = sn.pipeline.getCommands()
+
+        """
+        with self.commandLock:
+            if self.acceptCommands:
+                self.commandQueue.put((function, tuple(args), label))
+                return
+        self._applyCommand(function, tuple(args), label, False)
+
+
+    def getCommands(self):
+        """
+This function returns the commands of :meth:`queueCommand` that were applied.
+
+Returns
+-------
+    List[dict]:
+        | Label: name of the command
+        | Time: `Unfold` time of the last event before it
+        | Result: return value of the command
+
+        """
+        return list(self.commands)
+
+
+    def _applyCommands(self):
+        while True:
+            try:
+                function, args, label = self.commandQueue.get_nowait()
+            except queue.Empty:
+                return
+            self._applyCommand(function, args, label, True)
+
+
+    def _applyCommand(self, function, args, label, notify):
+        result = None
+        if function is not None:
+            try:
+                result = function(*args)
+            except Exception as e:
+                self.parent.logPrint(f"{Color.Red}Command \"{label}\" failed: {e}")
+        self.commands.append({"Label": label, "Time": self.lastTime, "Result": result})
+        if not notify:
+            return
+        for consumer in self.consumers:
+            if consumer in self.workers:
+                self.workers[consumer].put(_PipelineCommand(label, self.lastTime))
+            else:
+                consumer.onCommand(label, self.lastTime)
+
+
+    def _dispatch(self, times, channels):
+        copied = None
+        for consumer in self.consumers:
+            stats = self.consumerStats[consumer]
+            if consumer in self.workers:
+                if copied is None:
+                    copied = (np.array(times), np.array(channels))
+                self.workers[consumer].put(copied)
+                stats.queued(self.workers[consumer].qsize())
+            else:
+                start = time.perf_counter_ns()
+                consumer.process(times, channels)
+                stats.record(len(times), len(times), time.perf_counter_ns() - start)
+
+
+    def _work(self, consumer, blocks):
+        threadSettings.apply("Worker")
+        stats = self.consumerStats[consumer]
+        while True:
+            block = blocks.get()
+            if block is None:
+                break
+            if isinstance(block, _PipelineCommand):
+                consumer.onCommand(block.label, block.time)
+                continue
+            start = time.perf_counter_ns()
+            consumer.process(*block)
+            stats.record(len(block[0]), len(block[0]), time.perf_counter_ns() - start)
+
+
+    def getStats(self):
+        """
+This function returns the telemetry of all stages of the pipeline: the source (reading and decoding the
+blocks), every manipulator of the :obj:`chain` and every consumer. The counters are updated by the threads of
+the stages without locks, so they can be read at any time and are always on.
+
+Returns
+-------
+    dict:
+        the stats of each stage by name, each one a dict with:
+        
+        | NumBatches: number of blocks
+        | EventsIn / EventsOut: number of events in and out
+        | MeanBatch / MaxBatch: mean and maximum events per block
+        | Time: time spent [s]
+        | MaxTime / P50Time / P99Time: maximum, median and 99th percentile of the time per block [s]
+        | EventRate: events per second of time spent (the maximum throughput of the stage)
+        | QueueHighWater: maximum number of queued blocks of a threaded consumer
+        
+        and the ring of the stream (see :meth:`Unfold.getStreamStats`) as 'Stream' during an acquisition
+
+Example
+-------
+::
+
+    stats = sn.pipeline.getStats()
+    slowest = max(stats, key=lambda name: stats[name]["Time"])
+
+        """
+        stats = {self.sourceStats.name: self.sourceStats.toDict()}
+        if self.stream is not None and self.stream.ring is not None:
+            stats["Stream"] = self.stream.getStreamStats()
+        if self.chain is not None and self.chain.pipeline is self:
+            for stage in self.chain.stats:
+                stats[stage.name] = stage.toDict()
+        for consumer in self.consumers:
+            if consumer in self.consumerStats:
+                stage = self.consumerStats[consumer]
+                stats[stage.name] = stage.toDict()
+        return stats
+
+
+
+class _PipelineCommand():
+    def __init__(self, label, time):
+        self.label = label
+        self.time = time
+
+
+
+class PipelineConsumer():
+    """
+This is the base class of all consumers of the :class:`Pipeline`. A consumer gets every block of the `Unfold`
+data stream in :meth:`process`. To write your own consumer, derive from this class and overwrite the functions.
+
+Example
+-------
+::
+
+    # counts the events of channel 1
+    class Counter(PipelineConsumer):
+        def begin(self, pipeline):
+            self.counts = 0
+        def process(self, times, channels):
+            self.counts += np.count_nonzero(channels == 1)
+
+    counter = sn.pipeline.attach(Counter(sn))
+
+    """
+
+
+    def __init__(self, parent):
+        self.parent = parent
+        self.pipeline = None
+
+
+    def begin(self, pipeline):
+        """
+This function is called before the first block. The :class:`Pipeline` holds the information about the data stream.
+
+        """
+        self.pipeline = pipeline
+
+
+    def process(self, times, channels):
+        """
+This function is called for every block of the data stream.
+
+Warning
+-------
+    The arrays are only valid during this call. Copy them if they are needed afterwards.
+
+        """
+        pass
+
+
+    def end(self):
+        """
+This function is called after the last block.
+
+        """
+        pass
+
+
+    def clear(self):
+        """
+This function clears the results. It is called by :meth:`Pipeline.clearMeasure`.
+
+        """
+        pass
+
+
+    def onCommand(self, label: str, time: int):
+        """
+This function is called when a command of :meth:`Pipeline.queueCommand` was applied. All blocks before were
+processed with the old parameters. `time` is the `Unfold` time of the last event before the command.
+
+        """
+        pass
+
+
+
+class HistogramConsumer(PipelineConsumer):
+    """
+This pipeline consumer calculates histograms like the :class:`Histogram` class. In :obj:`.MeasMode.T2` the
+histograms hold the time differences between the last event of the reference channel and the events of all
+channels. In :obj:`.MeasMode.T3` they hold the dTimes. It is created by :meth:`Pipeline.histogram`.
+
+With `binEdges` the bins have any widths, e.g. logarithmic bins of :func:`snAPI.Utils.logBinEdges` that cover
+wide ranges of time differences with a few bins. With `pageSize` the histograms are stored sparse in a
+:class:`snAPI.Utils.PagedHistogram` and only the pages of bins that were hit take memory.
+
+    """
+
+
+    def __init__(self, parent, refChannel: typing.Optional[int] = 0, binWidth: typing.Optional[float] = None, numBins: typing.Optional[int] = None,
+                 binEdges = None, pageSize: typing.Optional[int] = None):
+        super().__init__(parent)
+        self.refChannel = refChannel
+        self.binWidth = binWidth
+        self.numBins = numBins
+        self.binEdges = None if binEdges is None else np.asarray(binEdges, dtype=np.float64)
+        self.pageSize = pageSize
+        self.numChans = 0
+        self.lastRef = -1
+        self.data = np.zeros((0, 0), dtype=np.int64)
+        self.bins = np.zeros(0)
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        if self.numBins is None:
+            self.numBins = pipeline.numBins
+        if self.binWidth is None:
+            if pipeline.measMode == MeasMode.T2:
+                self.binWidth = pipeline.baseResolution
+            else:
+                self.binWidth = pipeline.resolution
+        self.numChans = pipeline.numChans
+        self.lastRef = -1
+        if self.binEdges is not None:
+            self.numBins = len(self.binEdges) - 1
+            self.bins = self.binEdges[:-1]
+        else:
+            self.bins = np.multiply(np.arange(self.numBins, dtype='i8'), self.binWidth)
+        if self.pageSize:
+            self.data = PagedHistogram(self.numChans, self.numBins, self.pageSize)
+        else:
+            self.data = np.zeros((self.numChans, self.numBins), dtype=np.int64)
+
+
+    def process(self, times, channels):
+        valid = channels < self.numChans
+        if self.pipeline.measMode == MeasMode.T3:
+            dTimes = (times & 0x7FFF).astype(np.float64) * self.pipeline.resolution
+            self.add(channels[valid].astype(np.int64), dTimes[valid])
+            return
+        
+        times = times[valid].astype(np.int64)
+        channels = channels[valid].astype(np.int64)
+        isRef = channels == self.refChannel
+        refTimes = times[isRef]
+        # the events of the reference channel refer to the previous reference event
+        refIdx = np.searchsorted(refTimes, times, 'right') - 1 - isRef
+        last = np.where(refIdx >= 0, refTimes[np.maximum(refIdx, 0)] if len(refTimes) else 0, self.lastRef)
+        if len(refTimes):
+            self.lastRef = refTimes[-1]
+        hasRef = last >= 0
+        self.add(channels[hasRef], (times[hasRef] - last[hasRef]).astype(np.float64))
+
+
+    def add(self, channels, diffs):
+        """
+Adds the time differences `diffs` [ps] of the events in `channels` to the histograms.
+
+        """
+        if self.binEdges is not None:
+            bins = np.searchsorted(self.binEdges, diffs, 'right') - 1
+        else:
+            bins = np.floor(diffs / self.binWidth).astype(np.int64)
+        inside = (bins >= 0) & (bins < self.numBins)
+        if self.pageSize:
+            self.data.add(channels[inside], bins[inside])
+            return
+        flat = channels[inside] * self.numBins + bins[inside]
+        self.data += np.bincount(flat, minlength=self.numChans * self.numBins).reshape(self.numChans, self.numBins)
+
+
+    def clear(self):
+        if self.pageSize:
+            self.data.clear()
+        else:
+            self.data[:] = 0
+
+
+    def getData(self):
+        """
+This function returns the histograms like :meth:`Histogram.getData`.
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        data: 2DArray[int]
+            histograms of all channels (0 ist the sync channel)
+        bins: 1DArray[int]
+            start times of the bins [ps]
+
+        """
+        if self.pageSize:
+            return self.data.toDense(), self.bins
+        return self.data, self.bins
+
+
+    def getSparseData(self):
+        """
+This function returns only the bins with counts.
+
+Returns
+-------
+    tuple [1DArray, 1DArray, 1DArray]
+        channels: 1DArray[int]
+            channels of the bins
+        bins: 1DArray[float]
+            start times of the bins [ps]
+        counts: 1DArray[int]
+            counts of the bins
+
+        """
+        if self.pageSize:
+            channels, idx, counts = self.data.nonzero()
+        else:
+            channels, idx = np.nonzero(self.data)
+            counts = self.data[channels, idx]
+        return channels, self.bins[idx], counts
+
+
+
+class TimeTraceConsumer(PipelineConsumer):
+    """
+This pipeline consumer calculates a time trace like the :class:`TimeTrace` class. It holds the counts of the
+last `historySize` seconds in `numBins` bins per channel. It is created by :meth:`Pipeline.timeTrace`.
+
+    """
+
+
+    def __init__(self, parent, numBins: typing.Optional[int] = 10000, historySize: typing.Optional[float] = 10):
+        super().__init__(parent)
+        self.numBins = numBins
+        self.historySize = historySize
+        self.binWidth = historySize * 1e12 / numBins
+        self.numChans = 0
+        self.lastBin = -1
+        self.data = np.zeros((0, numBins), dtype=np.int64)
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        self.numChans = pipeline.numChans
+        self.lastBin = -1
+        self.data = np.zeros((self.numChans, self.numBins), dtype=np.int64)
+
+
+    def process(self, times, channels):
+        valid = channels < self.numChans
+        bins = np.floor(self.pipeline.toPs(times[valid]) / self.binWidth).astype(np.int64)
+        if not len(bins):
+            return
+        self.add(channels[valid].astype(np.int64), bins)
+
+
+    def add(self, channels, bins, counts=None):
+        """
+Adds the `counts` (default: 1 each) to the time ordered `bins` of the `channels`.
+
+        """
+        self.advance(bins[-1])
+        recent = bins > self.lastBin - self.numBins
+        flat = channels[recent] * self.numBins + bins[recent] % self.numBins
+        weights = None if counts is None else counts[recent]
+        self.data += np.bincount(flat, weights, minlength=self.numChans * self.numBins).reshape(self.numChans, self.numBins).astype(np.int64)
+
+
+    def advance(self, newBin):
+        """
+Moves the end of the time trace to the bin `newBin` and clears the bins that are reused.
+
+        """
+        if newBin <= self.lastBin:
+            return
+        if newBin - self.lastBin >= self.numBins:
+            self.data[:] = 0
+        else:
+            self.data[:, np.arange(self.lastBin + 1, newBin + 1) % self.numBins] = 0
+        self.lastBin = newBin
+
+
+    def clear(self):
+        self.data[:] = 0
+
+
+    def getData(self, normalized: typing.Optional[bool] = True, numLast: typing.Optional[int] = None):
+        """
+This function returns the time trace like :meth:`TimeTrace.getData`.
+
+Parameters
+----------
+    normalized: bool (default: True)
+        | True: counts per second
+        | False: counts per bin
+    numLast: int (default: None - all bins)
+        number of the last bins that are returned (only these are copied)
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        counts: 2DArray[float]
+            time traces of all channels (0 ist the sync channel)
+        times: 1DArray[float]
+            start times of the bins [s]
+
+        """
+        numLast = self.numBins if numLast is None else min(numLast, self.numBins)
+        order = np.arange(self.lastBin + 1 - numLast, self.lastBin + 1) % self.numBins
+        dataOut = self.data[:, order]
+        if normalized:
+            dataOut = np.multiply(dataOut, self.numBins / self.historySize)
+        times = np.multiply(np.arange(self.lastBin + 1 - numLast, self.lastBin + 1), self.binWidth * 1e-12)
+        return dataOut, times
+
+
+
+class TimeTracePyramidConsumer(PipelineConsumer):
+    """
+This pipeline consumer calculates time traces with several bin widths at once, e.g. 1ms, 10ms, 100ms and 1s bins.
+It is created by :meth:`Pipeline.timeTracePyramid`. Each level is a ring of `numBins` bins (a
+:class:`TimeTraceConsumer`), so a view can zoom from the last seconds to the last hours without processing the
+data again, a read copies only the bins of one level, and the memory stays the same however long it runs.
+
+The events of a block are counted once in bins of the finest level, and the coarser levels are decimated from
+these counts. So the cost of each further level depends on the number of bins of a block and not on the count rate.
+
+    """
+
+
+    def __init__(self, parent, binWidths: typing.Optional[typing.List[float]] = (1e-3, 1e-2, 1e-1, 1), numBins: typing.Optional[int] = 3600):
+        super().__init__(parent)
+        self.binWidths = sorted(binWidths)
+        """bin widths of the levels [s] (fine to coarse)"""
+        self.numBins = numBins
+        self.factors = [int(round(w / self.binWidths[0])) for w in self.binWidths]
+        if any(abs(f * self.binWidths[0] - w) > 1e-9 * w for f, w in zip(self.factors, self.binWidths)):
+            raise ValueError("the bin widths have to be multiples of the finest bin width")
+        self.levels = [TimeTraceConsumer(parent, numBins, numBins * w) for w in self.binWidths]
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        for level in self.levels:
+            level.begin(pipeline)
+
+
+    def process(self, times, channels):
+        fine = self.levels[0]
+        valid = channels < fine.numChans
+        bins = np.floor(self.pipeline.toPs(times[valid]) / fine.binWidth).astype(np.int64)
+        if not len(bins):
+            return
+        channels = channels[valid].astype(np.int64)
+        # the counts of each (bin, channel) of the finest level, the keys keep the order of the bins
+        keys, counts = np.unique((bins - bins[0]) * fine.numChans + channels, return_counts=True)
+        bins = keys // fine.numChans + bins[0]
+        channels = keys % fine.numChans
+        for level, factor in zip(self.levels, self.factors):
+            level.add(channels, bins // factor, counts)
+
+
+    def clear(self):
+        for level in self.levels:
+            level.clear()
+
+
+    def getLevel(self, span: float):
+        """
+This function returns the index of the finest level that holds the last `span` seconds.
+
+        """
+        for i, level in enumerate(self.levels):
+            if level.historySize >= span:
+                return i
+        return len(self.levels) - 1
+
+
+    def getData(self, span: typing.Optional[float] = None, level: typing.Optional[int] = None, normalized: typing.Optional[bool] = True):
+        """
+This function returns the last `span` seconds of the time trace from the finest level that holds them.
+
+Parameters
+----------
+    span: float [s] (default: None - the whole level)
+        time span of the returned time trace
+    level: int (default: None - the finest level that holds the `span`)
+        index of the level in :obj:`binWidths`
+    normalized: bool (default: True)
+        | True: counts per second
+        | False: counts per bin
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        counts: 2DArray[float]
+            time traces of all channels (0 ist the sync channel)
+        times: 1DArray[float]
+            start times of the bins [s]
+
+        """
+        if level is None:
+            level = self.getLevel(span) if span is not None else 0
+        trace = self.levels[level]
+        numLast = None if span is None else int(np.ceil(span / self.binWidths[level]))
+        return trace.getData(normalized, numLast)
+
+
+
+class G2MatrixConsumer(PipelineConsumer):
+    """
+This pipeline consumer calculates the g(2) correlations of many channel pairs in a single pass over the data stream.
+It is created by :meth:`Pipeline.g2Matrix` and used by :meth:`Correlation.setG2Matrix`.
+
+Each block is split into the event times of the used channels once. The events of each channel within the
+last `windowSize` are kept in a separate array per channel (structure of arrays), so no pairs get lost at
+the borders of the blocks and every pair only touches the arrays of its two channels.
+
+With `numThreads` the histogramming of each block runs on a thread pool, and all threads add into one shared
+histogram of (pairs, bins) int64 counts without a lock:
+
+- With at least as many pairs as threads every thread takes its own pairs and writes only their rows.
+- With fewer pairs the stop events of each pair are split into batches. Every thread adds its batches into its
+  own int32 histogram of the block (numThreads * pairs * bins * 4 bytes, with pairs < numThreads), and these
+  are summed into the shared histogram after the block.
+
+The loops over the pairs and the batches run in Python, so the threads only run in parallel in the numpy
+functions that release the GIL (e.g. the sorting and searching of the large arrays). The speedup is therefore
+well below `numThreads` and it is largest for wide windows, where most of the time is spent in these functions.
+
+    """
+
+    maxPairs = 1 << 22
+    """maximum number of event pairs that are evaluated at once (limits the temporary memory)"""
+
+
+    def __init__(self, parent, channels: typing.List[int], windowSize: float, binWidth: typing.Optional[float] = None,
+                 pairs: typing.Optional[typing.List[typing.Tuple[int, int]]] = None, numThreads: typing.Optional[int] = 1):
+        super().__init__(parent)
+        if pairs is None:
+            pairs = list(itertools.combinations_with_replacement(channels, 2))
+        self.pairs = [tuple(p) for p in pairs]
+        """list of the (startChannel, stopChannel) pairs in the order of the results"""
+        self.channels = sorted(set(c for p in self.pairs for c in p))
+        self.pairSlots = [(self.channels.index(a), self.channels.index(b)) for a, b in self.pairs]
+        self.slotOf = np.full(256, -1, dtype=np.int64)
+        self.slotOf[self.channels] = np.arange(len(self.channels))
+        self.windowSize = windowSize
+        self.binWidth = binWidth
+        self.numBins = 0
+        self.numThreads = max(numThreads or 1, 1)
+        self.pool = None
+        self.clear()
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        if self.binWidth is None:
+            if pipeline.measMode == MeasMode.T2:
+                self.binWidth = pipeline.baseResolution
+            else:
+                self.binWidth = pipeline.resolution
+        self.numBins = int(2 * self.windowSize / self.binWidth)
+        if self.numThreads > 1 and self.pool is None:
+            self.pool = concurrent.futures.ThreadPoolExecutor(self.numThreads, initializer=workerInit)
+        self.clear()
+
+
+    def process(self, times, channels):
+        if not len(times):
+            return
+        times = self.pipeline.toPs(times)
+        isT3 = self.pipeline.measMode == MeasMode.T3
+        if isT3:
+            # the events of a sync period are ordered by sync only, so the borders are the extremes of the block
+            first, last = times.min(), times.max()
+            self.lastTime = last if self.lastTime is None else max(self.lastTime, last)
+        else:
+            first = times[0]
+            self.lastTime = times[-1]
+        if self.firstTime is None:
+            self.firstTime = first
+
+        # split the block into the sorted event times of each channel
+        slots = self.slotOf[channels]
+        used = slots >= 0
+        slots = slots[used]
+        numSlots = len(self.channels)
+        counts = np.bincount(slots, minlength=numSlots)
+        new = np.split(times[used][np.argsort(slots, kind='stable')], np.cumsum(counts)[:-1])
+        if isT3:
+            # the dTimes of the events of one sync period are not strictly ordered, and histPairs needs sorted times
+            new = [np.sort(n) for n in new]
+        self.counts += counts
+        window = [np.concatenate((self.prev[i], new[i])) for i in range(numSlots)]
+        if isT3:
+            # the last sync period of the block before can go on in this block
+            window = [np.sort(w) for w in window]
+
+        tasks = []
+        for p, (a, b) in enumerate(self.pairSlots):
+            tasks.append((p, new[b], window[a]))
+            tasks.append((p, self.prev[b], new[a]))
+
+        def runPairs(thread):
+            # every thread takes its own pairs, so the rows of the shared histogram are written by one thread only
+            for p, stops, starts in tasks:
+                if p % self.numThreads == thread:
+                    histPairs(stops, starts, self.windowSize, self.binWidth, self.hist[p], self.maxPairs)
+
+        def runBatches(thread):
+            # every thread takes its own batch of the stop events of each task
+            for p, stops, starts in tasks:
+                first = len(stops) * thread // self.numThreads
+                last = len(stops) * (thread + 1) // self.numThreads
+                histPairs(stops[first:last], starts, self.windowSize, self.binWidth, self.partial[thread, p], self.maxPairs)
+
+        if not self.pool:
+            runPairs(0)
+        elif self.partial is None:
+            list(self.pool.map(runPairs, range(self.numThreads)))
+        else:
+            list(self.pool.map(runBatches, range(self.numThreads)))
+            self.hist += self.partial.sum(axis=0, dtype=np.int64)
+            self.partial.fill(0)
+        zeroBin = int(self.windowSize / self.binWidth)
+        for p, (a, b) in enumerate(self.pairSlots):
+            if a == b and zeroBin < self.numBins:
+                # an event is not correlated with itself
+                self.hist[p, zeroBin] -= counts[a]
+
+        self.prev = [w[w > self.lastTime - self.windowSize] for w in window]
+
+
+    def end(self):
+        if self.pool:
+            self.pool.shutdown()
+            self.pool = None
+
+
+    def clear(self):
+        self.hist = np.zeros((len(self.pairs), self.numBins), dtype=np.int64)
+        # the counts of one block per thread, only needed if the threads share the pairs
+        self.partial = None
+        if 1 < self.numThreads and len(self.pairs) < self.numThreads:
+            self.partial = np.zeros((self.numThreads, len(self.pairs), self.numBins), dtype=np.int32)
+        self.prev = [np.zeros(0, dtype=np.int64) for _ in self.channels]
+        self.counts = np.zeros(len(self.channels), dtype=np.int64)
+        self.firstTime = None
+        self.lastTime = None
+
+
+    def getData(self):
+        """
+This function returns the g(2) correlations of all pairs. Each one is normalized with :eq:`g2factor`.
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        data: 2DArray[float]
+            normalized g(2) correlations with the shape (pairs, bins) in the order of :obj:`pairs`
+        bins: 1DArray[float]
+            start times of the bins [s]
+
+        """
+        bins = np.multiply(np.arange(self.numBins) * self.binWidth - self.windowSize, 1e-12)
+        hist = self.hist
+        data = np.zeros(hist.shape)
+        if self.firstTime is None or self.lastTime == self.firstTime:
+            return data, bins
+        a = np.array([s[0] for s in self.pairSlots], dtype=np.int64)
+        b = np.array([s[1] for s in self.pairSlots], dtype=np.int64)
+        norm = self.counts[a] * self.counts[b] * self.binWidth
+        valid = norm > 0
+        data[valid] = hist[valid] * ((self.lastTime - self.firstTime) / norm[valid])[:, None]
+        return data, bins
+
+
+
+class CorrelationConsumer(G2MatrixConsumer):
+    """
+This pipeline consumer calculates the g(2) correlation of one channel pair like :meth:`Correlation.setG2Parameters`
+of the :class:`Correlation` class. It is created by :meth:`Pipeline.correlation`.
+
+    """
+
+
+    def __init__(self, parent, startChannel: int, stopChannel: int, windowSize: float, binWidth: typing.Optional[float] = None,
+                 numThreads: typing.Optional[int] = 1):
+        super().__init__(parent, [], windowSize, binWidth, [(startChannel, stopChannel)], numThreads)
+        self.startChannel = startChannel
+        self.stopChannel = stopChannel
+
+
+    def getData(self):
+        """
+This function returns the g(2) correlation like :meth:`Correlation.getG2Data`. It is normalized with :eq:`g2factor`.
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        data: 1DArray[float]
+            normalized g(2) correlation
+        bins: 1DArray[float]
+            start times of the bins [s]
+
+        """
+        data, bins = super().getData()
+        return data[0], bins
+
+
+
+class HeraldedG2Consumer(G2MatrixConsumer):
+    """
+This pipeline consumer calculates the g(2) correlations of the events in the gates of a herald channel like
+:meth:`Manipulators.herald` followed by :meth:`Pipeline.g2Matrix`, but in one pass without virtual channels.
+It is created by :meth:`Pipeline.heraldedG2`.
+
+The gates of all gated channels of a block are resolved at once with :func:`snAPI.Utils.gateIndex`. So also
+the heralded coincidences are counted in the same pass: the gated channels with an event in the gate of a
+herald are coded as a bitmask (bit k for the k-th channel of `gateChans`), and the heralds of every pattern are
+counted like in the :class:`CoincidenceMatrixConsumer`.
+
+    """
+
+    maxChannels = 24
+    """maximum number of gated channels (the coincidence histogram has 2^N entries)"""
+
+
+    def __init__(self, parent, herald: int, gateChans: typing.List[int], delayTime: float, gateTime: float, windowSize: float,
+                 binWidth: typing.Optional[float] = None, pairs: typing.Optional[typing.List[typing.Tuple[int, int]]] = None,
+                 numThreads: typing.Optional[int] = 1):
+        if len(gateChans) > self.maxChannels:
+            raise ValueError(f"a herald can have up to {self.maxChannels} gated channels")
+        self.herald = herald
+        self.gateChans = list(gateChans)
+        self.delayTime = delayTime
+        self.gateTime = gateTime
+        self.bitOf = np.zeros(256, dtype=np.int64)
+        self.bitOf[self.gateChans] = 1 << np.arange(len(self.gateChans), dtype=np.int64)
+        if pairs is None:
+            pairs = list(itertools.combinations(self.gateChans, 2))
+        super().__init__(parent, self.gateChans, windowSize, binWidth, pairs, numThreads)
+
+
+    def process(self, times, channels):
+        if not len(times):
+            return
+        ps = self.pipeline.toPs(times).astype(np.int64)
+        newHeralds = ps[channels == self.herald]
+        sel = np.flatnonzero(self.bitOf[channels] != 0)
+        if self.pipeline.measMode == MeasMode.T3:
+            # the dTimes of the events of one sync period are not strictly ordered, but gateIndex needs sorted heralds
+            # and the patterns need the events in the order of their heralds (a herald before the last one of the
+            # block before is only possible in a sync period split by the block border and is moved onto it)
+            newHeralds = np.maximum(np.sort(newHeralds), self.lastHerald)
+            sel = sel[np.argsort(ps[sel], kind='stable')]
+        heralds = np.concatenate(([self.lastHerald], newHeralds))
+        idx = gateIndex(heralds, ps[sel], self.delayTime, self.gateTime)
+        inside = idx >= 0
+        self._countPatterns(idx[inside], self.bitOf[channels[sel[inside]]], len(newHeralds))
+        self.numHeralds += len(newHeralds)
+        self.lastHerald = heralds[-1]
+        passed = sel[inside]
+        super().process(times[passed], channels[passed])
+
+
+    def end(self):
+        # the gate of the last herald is complete at the end of the stream
+        if self.pendingBits:
+            self.coincidences[self.pendingBits] += 1
+            self.pendingBits = 0
+        super().end()
+
+
+    def clear(self):
+        super().clear()
+        self.coincidences = np.zeros(1 << len(self.gateChans), dtype=np.int64)
+        self.lastHerald = np.iinfo(np.int64).min // 2
+        self.numHeralds = 0
+        self.pendingBits = 0
+
+
+    def getCoincidences(self):
+        """
+This function returns the number of heralds of every pattern of gated channels.
+
+Returns
+-------
+    counts: 1DArray[int]
+        heralds of the patterns, index bit k stands for the k-th channel of `gateChans` (counts[0]: the heralds
+        without any gated event)
+
+        """
+        counts = self.coincidences.copy()
+        counts[self.pendingBits] += 1
+        counts[0] = self.numHeralds - counts[1:].sum()
+        return counts
+
+
+    def getCounts(self, chans: typing.List[int], exact: typing.Optional[bool] = True):
+        """
+This function returns the number of heralds with events in the gates of a combination of channels.
+
+Parameters
+----------
+    chans: List[int]
+        gated channels of the combination
+    exact: bool (default: True)
+        | True: only the heralds with events of exactly these channels
+        | False: all heralds with events of at least these channels
+
+Returns
+-------
+    counts: int
+
+        """
+        counts = self.getCoincidences()
+        mask = int(np.bitwise_or.reduce(self.bitOf[list(chans)]))
+        if exact:
+            return int(counts[mask])
+        patterns = np.arange(len(counts))
+        return int(counts[(patterns & mask) == mask].sum())
+
+
+    def _countPatterns(self, idx, bits, numNew):
+        # idx 0 is the last herald of the block before, its gate may have been open across the border
+        if len(idx):
+            first = np.flatnonzero(np.diff(idx, prepend=-1))
+            heralds = idx[first]
+            patterns = np.bitwise_or.reduceat(bits, first)
+        else:
+            heralds = patterns = np.zeros(0, dtype=np.int64)
+        if len(heralds) and heralds[0] == 0:
+            self.pendingBits |= int(patterns[0])
+            heralds, patterns = heralds[1:], patterns[1:]
+        if not numNew:
+            return
+        # only the gate of the last herald can get more events in the next block
+        if self.pendingBits:
+            self.coincidences[self.pendingBits] += 1
+        self.pendingBits = 0
+        if len(heralds) and heralds[-1] == numNew:
+            self.pendingBits = int(patterns[-1])
+            heralds, patterns = heralds[:-1], patterns[:-1]
+        np.add.at(self.coincidences, patterns, 1)
+
+
+
+class FCSConsumer(PipelineConsumer):
+    """
+This pipeline consumer calculates the FCS correlation of one channel pair incrementally with the multiple tau
+algorithm. It is created by :meth:`Pipeline.fcs` and used by :meth:`Correlation.setLiveFCS`.
+
+The events are counted in a cascade of levels. The bins of each level are twice as wide as the bins of the level
+before and are made by merging them, so an event costs O(log(tau)). The first level correlates its bins at
+`intervalLength` lag times, and all further levels at the upper `intervalLength` / 2 of them. Each level only
+keeps the bins of its longest lag time, so the memory does not grow with the duration of the measurement, and
+:meth:`getData` returns the current correlation at any time. With `segmentTime` the partial correlations of
+consecutive segments are kept as well (see :meth:`getSegments`).
+
+    """
+
+
+    def __init__(self, parent, startChannel: int, stopChannel: int, windowSize: typing.Optional[float] = 1e12,
+                 startTime: typing.Optional[float] = None, intervalLength: typing.Optional[int] = 8,
+                 segmentTime: typing.Optional[float] = None):
+        super().__init__(parent)
+        self.startChannel = startChannel
+        self.stopChannel = stopChannel
+        self.windowSize = windowSize
+        self.startTime = startTime
+        self.intervalLength = max(2, intervalLength + intervalLength % 2)
+        self.segmentTime = segmentTime
+        self.tau0 = 1
+        self.levelLags = []
+        """lag times of each level in bins of the level"""
+        self.clear()
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        if self.startTime is None:
+            self.startTime = pipeline.baseResolution if pipeline.measMode == MeasMode.T2 else pipeline.resolution
+        self.tau0 = max(int(round(self.startTime)), 1)
+        p = self.intervalLength
+        self.levelLags = []
+        while True:
+            level = len(self.levelLags)
+            lags = np.arange(1 if level == 0 else p // 2 + 1, p + 1, dtype=np.int64)
+            lags = lags[lags * (self.tau0 << level) <= self.windowSize]
+            if not len(lags):
+                break
+            self.levelLags.append(lags)
+        self.clear()
+
+
+    def process(self, times, channels):
+        if not len(times):
+            return
+        times = self.pipeline.toPs(times)
+        a = times[channels == self.startChannel]
+        b = times[channels == self.stopChannel]
+        if self.pipeline.measMode == MeasMode.T3:
+            # the dTimes of the events of one sync period are not strictly ordered
+            a.sort()
+            b.sort()
+        if self.firstTime is None:
+            self.firstTime = self.segmentStart = times[0]
+        if self.segmentTime:
+            # the pairs are assigned to the segment of their later event
+            while times[-1] >= self.segmentStart + self.segmentTime:
+                border = self.segmentStart + self.segmentTime
+                numA = np.searchsorted(a, border)
+                numB = np.searchsorted(b, border)
+                self._add(a[:numA], b[:numB], border - 1)
+                a, b = a[numA:], b[numB:]
+                self._closeSegment(border)
+        self._add(a, b, times[-1])
+        self.lastTime = times[-1]
+
+
+    def clear(self):
+        numTaus = sum(len(lags) for lags in self.levelLags)
+        self.sumAB = np.zeros(numTaus, dtype=np.int64)
+        self.sumBA = np.zeros(numTaus, dtype=np.int64)
+        self.numA = 0
+        self.numB = 0
+        empty = (np.zeros(0, dtype=np.int64), np.zeros(0, dtype=np.int64))
+        self.binsA = [empty] * len(self.levelLags)
+        self.binsB = [empty] * len(self.levelLags)
+        self.firstTime = None
+        self.lastTime = None
+        self.segmentStart = None
+        self.segmentMark = (self.sumAB.copy(), self.sumBA.copy(), 0, 0)
+        self.segments = []
+
+
+    def getTaus(self):
+        """
+This function returns the lag times of the correlation :eq:`multiTau`.
+
+Returns
+-------
+    taus: 1DArray[float]
+        lag times [s]
+
+        """
+        if not self.levelLags:
+            return np.zeros(0)
+        return np.concatenate([lags * (self.tau0 << level) for level, lags in enumerate(self.levelLags)]) * 1e-12
+
+
+    def getData(self):
+        """
+This function returns the current FCS correlation like :meth:`Correlation.getFCSData`. Each lag time is
+normalized with :eq:`g2factor` with the bin width of its level.
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        data: 2DArray[float]
+            FCS correlation (A->B | B->A)
+        taus: 1DArray[float]
+            lag times [s]
+
+        """
+        if self.firstTime is None:
+            return np.zeros((2, len(self.sumAB))), self.getTaus()
+        span = self.lastTime - self.firstTime
+        return self._normalize(self.sumAB, self.sumBA, self.numA, self.numB, span), self.getTaus()
+
+
+    def getSegments(self):
+        """
+This function returns the partial FCS correlations of all finished segments of `segmentTime`. They can be used
+to reject segments with bright bursts and to average the others.
+
+Returns
+-------
+    tuple [3DArray, 1DArray, 2DArray, 1DArray]
+        data: 3DArray[float]
+            FCS correlations with the shape (segments, 2, taus) (A->B | B->A)
+        taus: 1DArray[float]
+            lag times [s]
+        countRates: 2DArray[float]
+            count rates of the two channels with the shape (segments, 2) [1/s]
+        startTimes: 1DArray[float]
+            start times of the segments [s]
+
+        """
+        data = np.zeros((len(self.segments), 2, len(self.sumAB)))
+        countRates = np.zeros((len(self.segments), 2))
+        startTimes = np.zeros(len(self.segments))
+        for i, (sumAB, sumBA, numA, numB, start, span) in enumerate(self.segments):
+            data[i] = self._normalize(sumAB, sumBA, numA, numB, span)
+            countRates[i] = numA * 1e12 / span, numB * 1e12 / span
+            startTimes[i] = start * 1e-12
+        return data, self.getTaus(), countRates, startTimes
+
+
+    def _normalize(self, sumAB, sumBA, numA, numB, span):
+        data = np.zeros((2, len(sumAB)))
+        if numA and numB and span > 0:
+            widths = np.concatenate([np.full(len(lags), self.tau0 << level) for level, lags in enumerate(self.levelLags)])
+            factor = span / (widths * numA * numB)
+            data[0] = sumAB * factor
+            data[1] = sumBA * factor
+        return data
+
+
+    def _closeSegment(self, border):
+        sumAB, sumBA, numA, numB = self.segmentMark
+        self.segments.append((self.sumAB - sumAB, self.sumBA - sumBA, self.numA - numA, self.numB - numB,
+                              self.segmentStart, border - self.segmentStart))
+        self.segmentMark = (self.sumAB.copy(), self.sumBA.copy(), self.numA, self.numB)
+        self.segmentStart = border
+
+
+    def _add(self, a, b, now):
+        self.numA += len(a)
+        self.numB += len(b)
+        newA = self._merge(a // self.tau0, np.ones(len(a), dtype=np.int64))
+        newB = self._merge(b // self.tau0, np.ones(len(b), dtype=np.int64))
+        now //= self.tau0
+        offset = 0
+        for level, lags in enumerate(self.levelLags):
+            if level:
+                newA = self._merge(newA[0] >> 1, newA[1])
+                newB = self._merge(newB[0] >> 1, newB[1])
+                now >>= 1
+            binsA = self._merge(np.concatenate((self.binsA[level][0], newA[0])), np.concatenate((self.binsA[level][1], newA[1])))
+            binsB = self._merge(np.concatenate((self.binsB[level][0], newB[0])), np.concatenate((self.binsB[level][1], newB[1])))
+            # the new events are correlated with all earlier ones (as the later event of a pair), the partial bins
+            # at the borders of the blocks are summed up linearly
+            self.sumAB[offset:offset + len(lags)] += self._correlate(newB, binsA, lags)
+            self.sumBA[offset:offset + len(lags)] += self._correlate(newA, binsB, lags)
+            offset += len(lags)
+            keepA = binsA[0] >= now - lags[-1]
+            keepB = binsB[0] >= now - lags[-1]
+            self.binsA[level] = (binsA[0][keepA], binsA[1][keepA])
+            self.binsB[level] = (binsB[0][keepB], binsB[1][keepB])
+
+
+    @staticmethod
+    def _merge(bins, weights):
+        # sums up the weights of equal (sorted) bins
+        if len(bins) < 2:
+            return bins, weights
+        starts = np.flatnonzero(np.diff(bins, prepend=bins[0] - 1))
+        return bins[starts], np.add.reduceat(weights, starts)
+
+
+    @staticmethod
+    def _correlate(new, bins, lags):
+        sums = np.zeros(len(lags), dtype=np.int64)
+        if not len(new[0]) or not len(bins[0]):
+            return sums
+        for i, lag in enumerate(lags):
+            target = new[0] - lag
+            pos = np.minimum(np.searchsorted(bins[0], target), len(bins[0]) - 1)
+            match = bins[0][pos] == target
+            sums[i] = np.dot(bins[1][pos[match]], new[1][match])
+        return sums
+
+
+
+class CoincidenceMatrixConsumer(PipelineConsumer):
+    """
+This pipeline consumer counts the coincidences of all combinations of up to 24 channels at once. It is created
+by :meth:`Pipeline.coincidenceMatrix`. The channels that take part in a coincidence are coded as a bitmask (bit k
+for the k-th channel of `chans`), and the counts of every bitmask pattern are summed up in a dense histogram of
+2^N entries. This replaces a separate :meth:`Manipulators.coincidence` with its own channel for every combination.
+
+    - :obj:`.CoincidenceMode.CountAll`: every event counts the pattern of the channels that have an event within
+      the `windowTime` before it (including itself). The patterns with a single bit are the single counts.
+    - :obj:`.CoincidenceMode.CountOnce`: the events are grouped, a group starts with an event and holds all events
+      within the `windowTime` after it (like the CountOnce of :meth:`Manipulators.coincidence`), and each group
+      counts the pattern of its channels once.
+
+    """
+
+    maxChannels = 24
+    """maximum number of channels (the histogram has 2^N entries)"""
+
+
+    def __init__(self, parent, chans: typing.List[int], windowTime: typing.Optional[float] = 1000,
+                 mode: typing.Optional[CoincidenceMode] = CoincidenceMode.CountAll):
+        super().__init__(parent)
+        if len(chans) > self.maxChannels:
+            raise ValueError(f"a coincidence matrix can have up to {self.maxChannels} channels")
+        self.chans = list(chans)
+        self.windowTime = windowTime
+        self.mode = mode
+        self.bitOf = np.zeros(256, dtype=np.int64)
+        self.bitOf[self.chans] = 1 << np.arange(len(self.chans), dtype=np.int64)
+        self.clear()
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        self.clear()
+
+
+    def process(self, times, channels):
+        used = self.bitOf[channels] != 0
+        if not used.any():
+            return
+        ps = self.pipeline.toPs(times[used])
+        bits = self.bitOf[channels[used]]
+        if self.pipeline.measMode == MeasMode.T3:
+            order = np.argsort(ps, kind='stable')
+            ps, bits = ps[order], bits[order]
+        if self.mode == CoincidenceMode.CountOnce:
+            self._countGroups(ps, bits)
+        else:
+            self._countWindows(ps, bits)
+
+
+    def clear(self):
+        self.counts = np.zeros(1 << len(self.chans), dtype=np.int64)
+        self.lastPs = np.full(len(self.chans), np.iinfo(np.int64).min // 2, dtype=np.int64)
+        self.groupPs = None
+        self.groupBits = 0
+
+
+    def end(self):
+        # the last group is complete at the end of the stream
+        if self.groupPs is not None:
+            self.counts[self.groupBits] += 1
+            self.groupPs = None
+            self.groupBits = 0
+
+
+    def getData(self):
+        """
+This function returns the counts of all patterns.
+
+Returns
+-------
+    counts: 1DArray[int]
+        counts of the patterns, index bit k stands for the k-th channel of `chans` (e.g. counts[0b101]: the
+        coincidences of the first and the third channel without the second one)
+
+        """
+        return self.counts.copy()
+
+
+    def getCounts(self, chans: typing.List[int], exact: typing.Optional[bool] = True):
+        """
+This function returns the counts of the coincidences of a combination of channels.
+
+Parameters
+----------
+    chans: List[int]
+        channels of the combination
+    exact: bool (default: True)
+        | True: only the patterns with exactly these channels
+        | False: all patterns that contain these channels
+
+Returns
+-------
+    counts: int
+
+        """
+        mask = int(np.bitwise_or.reduce(self.bitOf[list(chans)]))
+        if exact:
+            return int(self.counts[mask])
+        patterns = np.arange(len(self.counts))
+        return int(self.counts[(patterns & mask) == mask].sum())
+
+
+    def _countWindows(self, ps, bits):
+        num = len(ps)
+        pattern = np.zeros(num, dtype=np.int64)
+        for k in range(len(self.chans)):
+            # the latest event of each channel at every event (forward fill)
+            idx = np.maximum.accumulate(np.where(bits == 1 << k, np.arange(num), -1))
+            latest = np.where(idx >= 0, ps[idx], self.lastPs[k])
+            pattern |= np.where(latest >= ps - self.windowTime, 1 << k, 0)
+            if idx[-1] >= 0:
+                self.lastPs[k] = ps[idx[-1]]
+        self._addPatterns(pattern)
+
+
+    def _countGroups(self, ps, bits):
+        window = int(self.windowTime)
+        if self.groupPs is not None:
+            # the open group of the block before takes the events within the window after its first event
+            num = int(np.searchsorted(ps, self.groupPs + window, 'right'))
+            if num:
+                self.groupBits |= int(np.bitwise_or.reduce(bits[:num]))
+            if num == len(ps):
+                return
+            self._addPatterns(np.array([self.groupBits], dtype=np.int64))
+            ps, bits = ps[num:], bits[num:]
+        # a gap longer than the window always starts a group
+        runStarts = np.flatnonzero(np.diff(ps, prepend=ps[0] - window - 1) > window)
+        runEnds = np.append(runStarts[1:], len(ps))
+        starts = runStarts
+        long = np.flatnonzero(ps[runEnds - 1] - ps[runStarts] > window)
+        if len(long):
+            # in longer runs the next group starts with the first event behind the window of the group before
+            after = np.searchsorted(ps, ps + window, 'right')
+            extra = []
+            for r in long:
+                i = after[runStarts[r]]
+                while i < runEnds[r]:
+                    extra.append(i)
+                    i = after[i]
+            starts = np.sort(np.concatenate((runStarts, np.array(extra, dtype=runStarts.dtype))))
+        patterns = np.bitwise_or.reduceat(bits, starts)
+        # the last group can go on in the next block
+        self._addPatterns(patterns[:-1])
+        self.groupPs = int(ps[starts[-1]])
+        self.groupBits = int(patterns[-1])
+
+
+    def _addPatterns(self, patterns):
+        # only the patterns that occur are added, not a histogram of all 2^N patterns per block
+        if not len(patterns):
+            return
+        idx, counts = np.unique(patterns, return_counts=True)
+        np.add.at(self.counts, idx, counts)
+
+
+
+class FLIMConsumer(PipelineConsumer):
+    """
+This pipeline consumer builds a time resolved image in :obj:`.MeasMode.T3` (TCSPC-FLIM): a dTime
+histogram for every pixel and channel, a cube of (lines, pixels, channels, bins). It is created by
+:meth:`Pipeline.flim`.
+
+A line starts with the `lineStart` marker and ends with the `lineStop` marker (the pixel time is the
+duration of the line divided by the number of pixels) or after `numPixels` pixels of the given `pixelTime`.
+The `frame` marker starts the first line again, without it the lines wrap around after `numLines`. The
+frames are summed up. With a `binning` > 1 several dTime slots are summed into one bin.
+
+The cube is allocated once at the begin of the measurement from the :obj:`snAPI.Utils.bufferPool` with 32 bit
+counters. The channels and bins of a pixel are stored together, so the photons of the pixel that is scanned
+at the moment hit one small piece of memory.
+
+    """
+
+
+    def __init__(self, parent, numPixels: int, numLines: int, pixelTime: typing.Optional[float] = None, lineStart: typing.Optional[int] = 1,
+                 lineStop: typing.Optional[int] = 2, frame: typing.Optional[int] = 3, chans: typing.Optional[typing.List[int]] = None,
+                 binning: typing.Optional[int] = 1, numBins: typing.Optional[int] = None):
+        super().__init__(parent)
+        if not lineStart:
+            raise ValueError("a FLIM image needs a line start marker")
+        if not lineStop and not pixelTime:
+            raise ValueError("a FLIM image needs a line stop marker or a pixel time")
+        self.numPixels = numPixels
+        self.numLines = numLines
+        self.pixelTime = pixelTime
+        self.startBit = 1 << (lineStart - 1)
+        self.stopBit = 1 << (lineStop - 1) if lineStop else 0
+        self.frameBit = 1 << (frame - 1) if frame else 0
+        self.chans = None if chans is None else list(chans)
+        self.binning = max(int(binning), 1)
+        self.numBins = numBins
+        self.chanIdx = np.full(256, -1, dtype=np.int64)
+        self.cube = np.zeros(0, dtype=np.uint32)
+        self.bins = np.zeros(0)
+        self.enabled = False
+        self._reset()
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        self.enabled = pipeline.measMode == MeasMode.T3
+        if not self.enabled:
+            self.parent.logPrint(f"{Color.Red}A FLIM image can only be measured in T3 mode.")
+            return
+        if self.chans is None:
+            self.chans = list(range(1, pipeline.numChans))
+        self.chanIdx[:] = -1
+        self.chanIdx[self.chans] = np.arange(len(self.chans))
+        if self.numBins is None:
+            numDTimes = pipeline.syncPeriod / pipeline.resolution if pipeline.syncPeriod else 0x8000
+            self.numBins = int(np.ceil(min(numDTimes, 0x8000) / self.binning))
+        self.bins = np.multiply(np.arange(self.numBins, dtype='i8'), self.binning * pipeline.resolution)
+        size = self.numLines * self.numPixels * len(self.chans) * self.numBins
+        # the owner is the place of the consumer in the pipeline, so a new FLIM image takes the buffer of the one before
+        owner = f"FLIMConsumer.{id(pipeline)}[{pipeline.consumers.index(self)}]"
+        self.cube = np.frombuffer(bufferPool.array(ct.c_uint32, size, owner, zero=True), dtype=np.uint32)
+        self._reset()
+
+
+    def process(self, times, channels):
+        if not self.enabled:
+            return
+        isMarker = (channels & 0x80) != 0
+        ps = self.pipeline.toPs(times).astype(np.int64)
+        first = 0
+        # the photons between two markers belong to the same line
+        for idx in np.flatnonzero(isMarker):
+            self._addPhotons(ps[first:idx], times[first:idx], channels[first:idx])
+            self._marker(int(channels[idx]) & 0x7F, int(ps[idx]))
+            first = idx + 1
+        self._addPhotons(ps[first:], times[first:], channels[first:])
+
+
+    def clear(self):
+        self.cube[:] = 0
+        self._reset()
+
+
+    def getData(self):
+        """
+This function returns the histograms of all pixels.
+
+Returns
+-------
+    cube: 4DArray[int]
+        counts [lines, pixels, channels, bins]
+
+        """
+        return self.cube.reshape(self.numLines, self.numPixels, len(self.chans or []), self.numBins or 0)
+
+
+    def getIntensity(self):
+        """
+This function returns the intensity image (the sum over all bins).
+
+Returns
+-------
+    image: 3DArray[int]
+        counts [lines, pixels, channels]
+
+        """
+        return self.getData().sum(axis=3, dtype=np.int64)
+
+
+    def getDecay(self):
+        """
+This function returns the decay histograms of the whole image (the sum over all pixels).
+
+Returns
+-------
+    tuple [2DArray, 1DArray]
+        data: 2DArray[int]
+            histograms [channels, bins]
+        bins: 1DArray[int]
+            start times of the bins [ps]
+
+        """
+        return self.getData().sum(axis=(0, 1), dtype=np.int64), self.bins
+
+
+    def _reset(self):
+        self.line = -1
+        self.inLine = False
+        self.lineStartPs = 0
+        self.pending = []
+        self.numFrames = 0
+
+
+    def _marker(self, bits, ps):
+        if bits & self.frameBit:
+            self._endLine(ps)
+            self.line = -1
+            self.numFrames += 1
+        if bits & self.stopBit:
+            self._endLine(ps)
+        if bits & self.startBit:
+            self._endLine(ps)
+            self.line += 1
+            if self.line >= self.numLines:
+                self.line = 0
+                if not self.frameBit:
+                    self.numFrames += 1
+            self.inLine = True
+            self.lineStartPs = ps
+
+
+    def _addPhotons(self, ps, times, channels):
+        if not self.inLine or not len(ps):
+            return
+        chans = self.chanIdx[channels]
+        bins = (times & 0x7FFF).astype(np.int64) // self.binning
+        valid = (chans >= 0) & (bins < self.numBins)
+        if not self.pixelTime:
+            # the pixel time is known at the line stop
+            self.pending.append((ps[valid], chans[valid], bins[valid]))
+            return
+        self._accumulate((ps[valid] - self.lineStartPs) // int(self.pixelTime), chans[valid], bins[valid])
+
+
+    def _endLine(self, ps):
+        if not self.inLine:
+            return
+        self.inLine = False
+        if self.pixelTime or not self.pending:
+            self.pending = []
+            return
+        pixelTime = (ps - self.lineStartPs) / self.numPixels
+        if pixelTime > 0:
+            linePs, chans, bins = (np.concatenate(a) for a in zip(*self.pending))
+            self._accumulate(((linePs - self.lineStartPs) / pixelTime).astype(np.int64), chans, bins)
+        self.pending = []
+
+
+    def _accumulate(self, pixels, chans, bins):
+        inside = (pixels >= 0) & (pixels < self.numPixels)
+        if self.line < 0 or not inside.any():
+            return
+        flat = ((self.line * self.numPixels + pixels[inside]) * len(self.chans) + chans[inside]) * self.numBins + bins[inside]
+        idx, counts = np.unique(flat, return_counts=True)
+        self.cube[idx] += counts.astype(np.uint32)
+
+
+
+class RecorderConsumer(PipelineConsumer):
+    """
+This pipeline consumer writes the `Unfold` data stream into a compressed container file (see
+:class:`snAPI.Utils.TTZWriter`). It is created by :meth:`Pipeline.record`. The blocks are only copied in
+:meth:`process`, and the compression runs on worker threads. The file can be replayed with
+:meth:`Pipeline.startFile`.
+
+    """
+
+
+    def __init__(self, parent, path: str, chunkSize: typing.Optional[int] = 1048576, numThreads: typing.Optional[int] = 2,
+                 level: typing.Optional[int] = 1):
+        super().__init__(parent)
+        self.path = path
+        self.chunkSize = chunkSize
+        self.numThreads = numThreads
+        self.level = level
+        self.writer = None
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        self.writer = TTZWriter(self.path, pipeline.measMode == MeasMode.T3, pipeline.syncPeriod, pipeline.resolution,
+                                pipeline.baseResolution, pipeline.numChans, self.chunkSize, self.numThreads, self.level)
+
+
+    def process(self, times, channels):
+        self.writer.append(times, channels)
+
+
+    def end(self):
+        if self.writer and not self.writer.close():
+            self.parent.logPrint(f"{Color.Red}Writing {self.path} failed: {self.writer.error}")
+
+
+    def getStats(self):
+        """
+This function returns the number of written events and the compressed size.
+
+Returns
+-------
+    dict:
+        | NumEvents: number of events
+        | NumBytes: compressed size [bytes]
+        | WriteError: the error of the writing ("" if none)
+
+        """
+        if not self.writer:
+            return {}
+        return {"NumEvents": self.writer.numEvents, "NumBytes": self.writer.numBytes,
+                "WriteError": str(self.writer.error) if self.writer.error else ""}
+
+
+
+class ColumnarConsumer(PipelineConsumer):
+    """
+This pipeline consumer writes the `Unfold` data stream into a columnar file that other tools can memory-map:
+an Arrow IPC file ('arrow') or a Parquet file ('parquet'). It is created by :meth:`Pipeline.exportColumnar`. The
+times are stored as uint64 and the channels as a dictionary-encoded uint8 column (the dictionary holds all 256
+channel codes, so the channel codes are the indices and no mapping is needed). The events are collected up to
+`rowGroupSize` and then written as one record batch (row group), so the file grows during the measurement.
+
+Note
+----
+    This needs the `pyarrow` package.
+
+    """
+
+
+    def __init__(self, parent, path: str, format: typing.Optional[str] = "arrow", rowGroupSize: typing.Optional[int] = 1048576):
+        super().__init__(parent)
+        self.path = path
+        self.format = format
+        self.rowGroupSize = rowGroupSize
+        self.writer = None
+        self.pending = []
+        self.numPending = 0
+        self.numEvents = 0
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        import pyarrow as pa
+        self.pa = pa
+        self.dictionary = pa.array(np.arange(256, dtype=np.uint8))
+        self.schema = pa.schema([("times", pa.uint64()), ("channels", pa.dictionary(pa.uint8(), pa.uint8()))],
+                                metadata={"MeasMode": pipeline.measMode.name, "SyncPeriod": str(pipeline.syncPeriod),
+                                          "Resolution": str(pipeline.resolution), "BaseResolution": str(pipeline.baseResolution)})
+        if self.format == "parquet":
+            import pyarrow.parquet as pq
+            self.writer = pq.ParquetWriter(self.path, self.schema)
+        else:
+            self.writer = pa.ipc.new_file(self.path, self.schema)
+        self.pending = []
+        self.numPending = 0
+        self.numEvents = 0
+
+
+    def process(self, times, channels):
+        self.pending.append((times.copy(), channels.copy()))
+        self.numPending += len(times)
+        if self.numPending >= self.rowGroupSize:
+            self._flush()
+
+
+    def end(self):
+        if self.writer is None:
+            return
+        self._flush()
+        self.writer.close()
+        self.writer = None
+
+
+    def _flush(self):
+        if not self.numPending:
+            return
+        times = np.concatenate([p[0] for p in self.pending])
+        channels = np.concatenate([p[1] for p in self.pending])
+        pa = self.pa
+        batch = pa.record_batch([pa.array(times, type=pa.uint64()), pa.DictionaryArray.from_arrays(pa.array(channels), self.dictionary)],
+                                schema=self.schema)
+        if self.format == "parquet":
+            self.writer.write_batch(batch)
+        else:
+            self.writer.write(batch)
+        self.numEvents += len(times)
+        self.pending = []
+        self.numPending = 0
+
+
+
+class CallbackConsumer(PipelineConsumer):
+    """
+This pipeline consumer pushes the data stream to callbacks instead of being polled. It is created by
+:meth:`Pipeline.callback`.
+
+    - `onData(times, channels)` is called with the collected `Unfold` data as soon as `batchSize` events or
+      a `timeSlice` of data time are collected.
+    - `onBins(time, counts)` is called for every completed bin of `binWidth` with the counts of all channels
+      (like a bin of :class:`TimeTraceConsumer`). With the channels of :meth:`Manipulators.countrate` or any
+      other channel this gives count rate updates. At the end of the stream the last bin is reported as well,
+      it only covers the time up to the last event. After a gap of more than :obj:`maxBins` empty bins only
+      the last :obj:`maxBins` of them are reported, the bins with counts are always reported.
+
+Every time a callback fires, :obj:`event` is set as well, so a thread can wait for it with :meth:`wait` instead
+of polling. Small batches and bins give a low latency, large ones less overhead. The latency is also limited by
+the `pollTime` of :meth:`Pipeline.start`.
+
+Warning
+-------
+    The callbacks run on the thread of the pipeline (or of the consumer if it is threaded) and must return
+    quickly, otherwise they slow down the processing.
+
+    """
+
+    maxBins = 1000
+    """maximum number of empty bins reported for a gap in the data stream"""
+
+
+    def __init__(self, parent, onData=None, batchSize: typing.Optional[int] = None, timeSlice: typing.Optional[float] = None,
+                 onBins=None, binWidth: typing.Optional[float] = None):
+        super().__init__(parent)
+        self.onData = onData
+        self.batchSize = batchSize
+        self.timeSlice = timeSlice
+        self.onBins = onBins
+        self.binWidth = binWidth
+        self.event = threading.Event()
+        """set every time a callback fires"""
+        self.numChans = 0
+        self.clear()
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        self.numChans = pipeline.numChans
+        self.clear()
+
+
+    def clear(self):
+        self.pending = []
+        self.numPending = 0
+        self.firstPs = None
+        self.currentBin = None
+        self.counts = np.zeros(self.numChans, dtype=np.int64)
+
+
+    def process(self, times, channels):
+        if not len(times):
+            return
+        ps = None
+        if self.onData is not None:
+            self.pending.append((times.copy(), channels.copy()))
+            self.numPending += len(times)
+            if self.timeSlice is not None:
+                ps = self.pipeline.toPs(times)
+                if self.firstPs is None:
+                    self.firstPs = ps[0]
+            if (self.batchSize is not None and self.numPending >= self.batchSize) or \
+               (self.timeSlice is not None and ps[-1] - self.firstPs >= self.timeSlice) or \
+               (self.batchSize is None and self.timeSlice is None):
+                self._fireData()
+        if self.onBins is not None and self.binWidth:
+            if ps is None:
+                ps = self.pipeline.toPs(times)
+            self._countBins(ps, channels)
+
+
+    def end(self):
+        if self.numPending:
+            self._fireData()
+        if self.currentBin is not None:
+            # the last bin is reported although it is not complete
+            self.onBins(self.currentBin * self.binWidth * 1e-12, self.counts)
+            self.event.set()
+            self.currentBin = None
+            self.counts = np.zeros(self.numChans, dtype=np.int64)
+
+
+    def wait(self, timeout: typing.Optional[float] = None):
+        """
+This function waits until a callback fires.
+
+Parameters
+----------
+    timeout: float (default: None - no timeout)
+        maximum time to wait [s]
+
+Returns
+-------
+    True: a callback fired
+    False: timeout
+
+        """
+        fired = self.event.wait(timeout)
+        self.event.clear()
+        return fired
+
+
+    def _fireData(self):
+        times = np.concatenate([p[0] for p in self.pending])
+        channels = np.concatenate([p[1] for p in self.pending])
+        self.pending = []
+        self.numPending = 0
+        self.firstPs = None
+        self.onData(times, channels)
+        self.event.set()
+
+
+    def _countBins(self, ps, channels):
+        valid = channels < self.numChans
+        bins = (ps[valid] // self.binWidth).astype(np.int64)
+        channels = channels[valid].astype(np.int64)
+        if not len(bins):
+            return
+        if self.currentBin is None:
+            self.currentBin = int(bins[0])
+        # only the bins with counts are histogrammed, so a gap in the data does not need any memory
+        used, inverse = np.unique(np.maximum(bins, self.currentBin), return_inverse=True)
+        counts = np.bincount(inverse * self.numChans + channels, minlength=len(used) * self.numChans)
+        counts = counts.reshape(-1, self.numChans)
+        if used[0] == self.currentBin:
+            counts[0] += self.counts
+        else:
+            used = np.concatenate(([self.currentBin], used))
+            counts = np.concatenate((self.counts[None, :], counts))
+        # the bins before the last one of the block are complete
+        for i in range(len(used) - 1):
+            self.onBins(int(used[i]) * self.binWidth * 1e-12, counts[i])
+            for b in range(max(int(used[i]) + 1, int(used[i + 1]) - self.maxBins), int(used[i + 1])):
+                self.onBins(b * self.binWidth * 1e-12, np.zeros(self.numChans, dtype=np.int64))
+        if len(used) > 1:
+            self.event.set()
+        self.counts = counts[-1].copy()
+        self.currentBin = int(used[-1])
+
+
+
+class UnfoldConsumer(PipelineConsumer):
+    """
+This pipeline consumer stores the `Unfold` data stream like :meth:`Unfold.measure`. It is created by :meth:`Pipeline.unfold`.
+
+    """
+
+
+    def __init__(self, parent, size: typing.Optional[int] = 134217728):
+        super().__init__(parent)
+        self.size = size
+        self.times = np.zeros(0, dtype=np.uint64)
+        self.channels = np.zeros(0, dtype=np.uint8)
+        self.numRead = 0
+        self.numLost = 0
+
+
+    def begin(self, pipeline):
+        super().begin(pipeline)
+        if len(self.times) != self.size:
+            self.times = np.empty(self.size, dtype=np.uint64)
+            self.channels = np.empty(self.size, dtype=np.uint8)
+        self.clear()
+
+
+    def process(self, times, channels):
+        length = min(len(times), self.size - self.numRead)
+        self.times[self.numRead:self.numRead + length] = times[:length]
+        self.channels[self.numRead:self.numRead + length] = channels[:length]
+        self.numRead += length
+        self.numLost += len(times) - length
+
+
+    def clear(self):
+        self.numRead = 0
+        self.numLost = 0
+
+
+    def getData(self):
+        """
+This function returns the stored data like :meth:`Unfold.getData`.
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: 1DArray[int]
+            `Unfold` data array of timetags
+        channels: 1DArray[int]
+            `Unfold` data array of channel information
+
+        """
+        return self.times[:self.numRead], self.channels[:self.numRead]
+
+
+
+class MultiDeviceSession():
+    """
+This class acquires the `Unfold` data of several devices at the same time and merges them into one time-ordered
+stream that is processed by its :obj:`pipeline`. The API handles one device per process, so every device is run
+in a worker process of its own with its own acquisition thread. The blocks of the devices are merged up to the
+latest time all devices have reached, so the merged stream is ordered over all devices and the consumers of the
+pipeline (e.g. :meth:`Pipeline.histogram` or :meth:`Pipeline.correlation`) can use channel pairs of different
+devices.
+
+The devices need a common timebase, e.g. by linking them with White Rabbit (see :class:`WhiteRabbit`), and they
+are measured in :obj:`.MeasMode.T2`. The channels of the devices are numbered one after the other: device 0
+keeps its channel numbers, and the sync and the channels of every further device follow the channels of the
+device before (see :meth:`getChannel`). The markers keep their values.
+
+A device without events (e.g. with dark channels) sends heartbeats with its acquisition time minus a safety
+margin of :obj:`sessionHeartbeatDelay`, so the other devices are merged on while it is idle. The events that
+such a device delivers later than the margin are merged out of order.
+
+Parameters
+----------
+    parent: snAPI
+        the snAPI object of this process (used for logging)
+    devices: List[str | dict]
+        | one entry per device, either the identifier of the device or a dict with the keys:
+        | "ID": identifier of the device (see :meth:`snAPI.getDevice`)
+        | "RefSource": :class:`.RefSource` of :meth:`snAPI.initDevice` (default: :obj:`.RefSource.Internal`)
+        | "MeasControl": :class:`.MeasControl` of :meth:`Device.setMeasControl` (optional)
+        | "IniFile": ini file for :meth:`snAPI.loadIniConfig` (optional)
+        | "TimeOffset": offset added to the times of the device [ps], can be negative (default: 0)
+        | the measurements are started in this order (e.g. the White Rabbit slaves before the master)
+
+Example
+-------
+::
+
+    # correlates channel 1 of a White Rabbit slave with channel 1 of the master
+    session = MultiDeviceSession(sn, [
+        {"ID": "1045483", "RefSource": RefSource.Wr_Slave_Harp, "MeasControl": MeasControl.WrMaster2Slave, "IniFile": "config\\MH.ini"},
+        {"ID": "1045484", "RefSource": RefSource.Wr_Master_Harp, "MeasControl": MeasControl.WrMaster2Slave, "IniFile": "config\\MH.ini"}])
+    session.open()
+    g2 = session.pipeline.correlation(session.getChannel(0, 1), session.getChannel(1, 1), 100000, 100)
+    session.start(10000, waitFinished=True)
+    data, bins = g2.getData()
+
+    """
+
+
+    def __init__(self, parent, devices: typing.List[typing.Union[str, dict]]):
+        self.parent = parent
+        self.devices = [d if isinstance(d, dict) else {"ID": d} for d in devices]
+        self.pipeline = Pipeline(parent)
+        """the :class:`Pipeline` that processes the merged stream"""
+        self.channelOffsets = []
+        """first channel number of each device in the merged stream"""
+        self.infos = []
+        self.processes = []
+        self.queues = []
+        self.commands = []
+        self.stop = None
+
+
+    def open(self):
+        """
+This function starts the worker processes and opens and initializes the devices in them. After that the
+channel numbers of the merged stream are known (see :meth:`getChannel`). After a measurement the devices
+are closed again, so `open` has to be called before every :meth:`start`.
+
+Returns
+-------
+    True: operation successful
+    False: operation failed
+
+        """
+        self.close()
+        context = multiprocessing.get_context("spawn")
+        self.stop = context.Event()
+        for device in self.devices:
+            blocks, commands = context.Queue(), context.Queue()
+            process = context.Process(target=_sessionWorker, args=(device, blocks, commands, self.stop), daemon=True)
+            process.start()
+            self.processes.append(process)
+            self.queues.append(blocks)
+            self.commands.append(commands)
+            info = blocks.get()
+            self.infos.append(info)
+            if not info["Ok"]:
+                self.parent.logPrint(f"{Color.Red}Can't open device \"{device.get('ID')}\" of the session!")
+                self.close()
+                return False
+
+        self.channelOffsets = list(itertools.accumulate([0] + [info["NumChans"] for info in self.infos[:-1]]))
+        numChans = self.channelOffsets[-1] + self.infos[-1]["NumChans"]
+        if numChans > 0x80:
+            self.parent.logPrint(f"{Color.Red}The session has too many channels: {numChans}!")
+            self.close()
+            return False
+        self.pipeline.measMode = MeasMode.T2
+        self.pipeline.baseResolution = self.infos[0]["BaseResolution"]
+        self.pipeline.resolution = self.infos[0]["BaseResolution"]
+        self.pipeline.numBins = 65536
+        self.pipeline.numChans = numChans
+        self.pipeline.syncPeriod = 0.0
+        return True
+
+
+    def start(self, acqTime: typing.Optional[int] = 1000, waitFinished: typing.Optional[bool] = False, pollTime: typing.Optional[float] = 10):
+        """
+This function starts the acquisitions of the devices one after the other and the processing of the merged
+stream by the :obj:`pipeline`. The devices are opened by :meth:`open` before if needed.
+
+Parameters
+----------
+    acqTime: int (default: 1s)
+        | 0: means the measurement will run until :meth:`stopMeasure`
+        | acquisition time [ms]
+    waitFinished: bool (default: False)
+        True: block execution until finished (will be False on acqTime = 0)
+    pollTime: float (default: 10ms)
+        time between two block reads [ms]
+
+Returns
+-------
+    True: operation successful
+    False: operation failed
+
+        """
+        if self.pipeline.running:
+            self.parent.logPrint(f"{Color.Red}The session is already running!")
+            return False
+        if not self.processes and not self.open():
+            return False
+        for device, blocks, commands in zip(self.devices, self.queues, self.commands):
+            # the next device is started after this one is running
+            commands.put((acqTime, pollTime))
+            if not blocks.get():
+                self.parent.logPrint(f"{Color.Red}Can't start device \"{device.get('ID')}\" of the session!")
+                self.close()
+                return False
+        maps = []
+        for offset in self.channelOffsets:
+            channelMap = np.arange(256, dtype=np.uint8)
+            channelMap[:0x80] = np.arange(offset, offset + 0x80) % 0x80
+            maps.append(channelMap)
+        return self.pipeline._run(self._mergeSource(maps, pollTime), waitFinished and acqTime > 0)
+
+
+    def getChannel(self, device: int, channel: int):
+        """
+This function returns the number of a channel of a device in the merged stream. It is valid after :meth:`open`.
+
+Parameters
+----------
+    device: int
+        index of the device in the list of the session
+    channel: int
+        channel of the device (0 is sync channel)
+
+Returns
+-------
+    channel: int
+
+        """
+        return self.channelOffsets[device] + channel
+
+
+    def stopMeasure(self):
+        """
+This function stops the acquisitions of all devices. The data that is already acquired will be processed completely.
+
+Returns
+-------
+    None
+
+        """
+        if self.stop is not None:
+            self.stop.set()
+
+
+    def isFinished(self):
+        """
+This function reports whether the session is finished.
+
+Returns
+-------
+    True: the session is finished
+    False: the session is running
+
+        """
+        return self.pipeline.isFinished()
+
+
+    def close(self):
+        """
+This function stops the acquisitions and ends the worker processes of the devices.
+
+Returns
+-------
+    None
+
+        """
+        self.stopMeasure()
+        for commands in self.commands:
+            commands.put(None)
+        for process, blocks in zip(self.processes, self.queues):
+            # a process can only end after its queue is empty
+            while process.is_alive():
+                try:
+                    blocks.get(timeout=0.1)
+                except queue.Empty:
+                    pass
+            process.join()
+        self.infos, self.processes, self.queues, self.commands = [], [], [], []
+
+
+    def _mergeSource(self, maps, pollTime):
+        numDevices = len(self.queues)
+        pending = [[] for _ in range(numDevices)]
+        lastTimes = [None] * numDevices
+        active = [True] * numDevices
+        # the offsets can be negative for the alignment, the times are shifted in int64 and clamped at 0
+        offsets = [np.int64(d.get("TimeOffset", 0)) for d in self.devices]
+        while True:
+            received = False
+            for d, blocks in enumerate(self.queues):
+                while active[d]:
+                    try:
+                        block = blocks.get_nowait()
+                    except queue.Empty:
+                        break
+                    received = True
+                    if block is None:
+                        active[d] = False
+                    elif isinstance(block[0], str):
+                        # a device without events has reached at least the time of its heartbeat
+                        heartbeat = max(int(block[1]) + int(offsets[d]), 0)
+                        lastTimes[d] = heartbeat if lastTimes[d] is None else max(lastTimes[d], heartbeat)
+                    else:
+                        times = np.maximum(block[0].astype(np.int64) + offsets[d], 0).astype(np.uint64)
+                        pending[d].append((times, maps[d][block[1]]))
+                        lastTimes[d] = int(times[-1]) if lastTimes[d] is None else max(lastTimes[d], int(times[-1]))
+
+            # the events up to the latest time all running devices have reached can be merged
+            running = [d for d in range(numDevices) if active[d]]
+            waiting = any(lastTimes[d] is None for d in running)
+            watermark = min(lastTimes[d] for d in running) if running and not waiting else None
+            parts = []
+            for d in range(numDevices):
+                if not pending[d] or waiting:
+                    continue
+                times = np.concatenate([b[0] for b in pending[d]])
+                channels = np.concatenate([b[1] for b in pending[d]])
+                num = len(times) if watermark is None else int(np.searchsorted(times, watermark, 'right'))
+                parts.append((times[:num], channels[:num]))
+                pending[d] = [(times[num:], channels[num:])] if num < len(times) else []
+            times, channels = mergeSorted(parts)
+            if len(times):
+                yield times, channels
+            if not running:
+                break
+            if not received:
+                self.pipeline._idle(pollTime)
+        self.close()
+
+
+
+sessionHeartbeat = 0.1
+"""time between two heartbeats of an idle device of a :class:`MultiDeviceSession` [s]"""
+sessionHeartbeatDelay = 1.0
+"""safety margin between the acquisition time of an idle device and the time of its heartbeat [s]"""
+
+
+def _sessionWorker(device, blocks, commands, stop):
+    # runs one device of a :class:`MultiDeviceSession` in its own process
+    sn = snAPI()
+    ok = sn.getDevice(device["ID"]) if device.get("ID") is not None else sn.getDevice()
+    if ok:
+        sn.initDevice(MeasMode.T2, device.get("RefSource", RefSource.Internal))
+        if device.get("MeasControl") is not None:
+            sn.device.setMeasControl(device["MeasControl"])
+        if device.get("IniFile"):
+            sn.loadIniConfig(device["IniFile"])
+    blocks.put({"Ok": bool(ok), "NumChans": sn.getNumAllChannels() if ok else 0,
+                "BaseResolution": sn.deviceConfig["BaseResolution"] if ok else 0.0})
+    command = commands.get() if ok else None
+    if command is None:
+        return
+    acqTime, pollTime = command
+    ok = sn.unfold.startStream(acqTime, pollTime=pollTime)
+    blocks.put(bool(ok))
+    stopped = False
+    started = time.perf_counter()
+    lastHeartbeat = started
+    while ok:
+        if stop.is_set() and not stopped:
+            sn.unfold.stopMeasure()
+            stopped = True
+        finished = sn.unfold.isFinished()
+        times, channels = sn.unfold.acquireBlock()
+        if len(times):
+            blocks.put((np.array(times), np.array(channels)))
+        sn.unfold.releaseBlock()
+        if finished:
+            break
+        if not len(times):
+            now = time.perf_counter()
+            if now - lastHeartbeat >= sessionHeartbeat:
+                # an idle device (e.g. a dark channel) must not hold back the merge of the others
+                blocks.put(("Heartbeat", max(now - started - sessionHeartbeatDelay, 0) * 1e12))
+                lastHeartbeat = now
+            time.sleep(pollTime / 1000)
+    blocks.put(None)
+    commands.get()
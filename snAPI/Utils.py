@@ -1,5 +1,19 @@
 # Torsten Krause, PicoQuant GmbH, 2023
 
+import concurrent.futures
+import configparser
+import ctypes as ct
+import json
+import mmap
+import numpy as np
+import os
+import queue
+import struct
+import threading
+import time
+import typing
+import zlib
+
 class Color:
     Rst ='\033[0m'
 
@@ -127,4 +141,1970 @@ class Color:
     On_ICya ='\033[0;106m'
     """high intensity background cyan"""
     On_IWhi ='\033[0;107m'
-    """high intensity background white"""
\ No newline at end of file
+    """high intensity background white"""
+
+
+dllPrototypes = {
+    "logExternal": ([ct.c_char_p], None),
+    "logError": ([ct.c_char_p], None),
+    "getSyncPeriod": ([ct.POINTER(ct.c_double)], None),
+    "setRowEventFilter": (None, ct.c_bool),
+    "enableRowEventFilter": (None, ct.c_bool),
+    "setMainEventFilterParams": (None, ct.c_bool),
+    "setMainEventFilterChannels": (None, ct.c_bool),
+    "enableMainEventFilter": (None, ct.c_bool),
+    "setFilterTestMode": (None, ct.c_bool),
+    "WRabbitSetMode": (None, ct.c_bool),
+    "WRabbitSetTime": (None, ct.c_bool),
+    "WRabbitInitLink": (None, ct.c_bool),
+    "rawMeasure": (None, ct.c_bool),
+    "rawStartBlock": (None, ct.c_bool),
+    "ufMeasure": (None, ct.c_bool),
+    "ufStartBlock": (None, ct.c_bool),
+    "setHistoT2RefChan": ([ct.c_uint8], None),
+    "setHistoT2BinWidth": ([ct.c_uint64], None),
+    "getHistogram": (None, ct.c_bool),
+    "setTimeTraceHistorySize": ([ct.c_double], None),
+    "getTimeTrace": (None, ct.c_bool),
+    "setG2Params": ([ct.c_int, ct.c_int, ct.c_double, ct.c_double], None),
+    "setFCSParams": ([ct.c_int, ct.c_int, ct.POINTER(ct.c_int), ct.c_int, ct.c_double, ct.c_double], None),
+    "setFFCSParams": ([ct.c_int, ct.c_int, ct.POINTER(ct.c_int), ct.c_int, ct.c_double, ct.c_double], None),
+    "getCorrelation": (None, ct.c_bool),
+    "addMCoincidence": ([ct.c_void_p, ct.c_int, ct.c_double, ct.c_int, ct.c_int, ct.c_bool], None),
+    "addMDelay": ([ct.c_int, ct.c_double, ct.c_bool], None),
+    "addMCountRate": ([ct.c_double], None),
+}
+"""argtypes and restype of the functions of the snAPI.dll that differ from the defaults of ctypes"""
+
+
+def setPrototypes(dll):
+    """
+Sets the :obj:`dllPrototypes` of the functions of the `dll` once when it is loaded, so the calls do not have to
+set them again every time. The functions of a `ctypes.WinDLL` release the GIL while they run, so blocking calls
+like a measurement with `waitFinished` do not stop the other Python threads.
+
+Returns
+-------
+    dll
+
+    """
+    for name, (argtypes, restype) in dllPrototypes.items():
+        function = getattr(dll, name, None)
+        if function is None:
+            continue
+        if argtypes is not None:
+            function.argtypes = argtypes
+        if restype is not None:
+            function.restype = restype
+    return dll
+
+
+def ctView(array, shape=None):
+    """
+Returns the first elements of the ctypes `array` as a numpy array of `shape` (default: the whole array) without
+a copy. The numpy array keeps the ctypes array alive and supports the buffer protocol.
+
+    """
+    data = np.ctypeslib.as_array(array)
+    if shape is None:
+        return data
+    return data[:int(np.prod(shape))].reshape(shape)
+
+
+class ThreadSettings:
+    """
+This holds the threading model of the threads snAPI starts in Python: the number of worker threads and the CPU
+affinity and priority of each thread role. The settings are applied by every thread of a role when it starts.
+
+    - Reader: the threads that read the blocks from the API (the rings of :meth:`snAPI.Main.Raw.startStream`
+      and :meth:`snAPI.Main.Unfold.startStream`)
+    - Pipeline: the thread of the :class:`snAPI.Main.Pipeline` that decodes the blocks and runs the chain
+    - Worker: the threaded consumers and the thread pools (decoding of files, correlation, compression)
+    - Writer: the I/O threads of :class:`PTUWriter` and :class:`TTZWriter`
+
+If the reader is pinned to CPUs, the memory of its ring is allocated and first touched by the reader thread,
+so the operating system puts it on the NUMA node of these CPUs.
+The settings can be loaded from the [Threads] section of the system.ini (see :meth:`snAPI.Main.snAPI.initAPI`)::
+
+    [Threads]
+    Workers = 8
+    ReaderCpus = 2
+    ReaderPriority = TimeCritical
+    PipelineCpus = 3
+    PipelinePriority = Highest
+    WorkerCpus = 4-11
+
+Note
+----
+    The threads inside the API are not affected.
+
+    """
+
+    roles = ("Reader", "Pipeline", "Worker", "Writer")
+    """thread roles"""
+
+    priorities = {"Idle": (-15, 19), "Lowest": (-2, 10), "BelowNormal": (-1, 5), "Normal": (0, 0),
+                  "AboveNormal": (1, -5), "Highest": (2, -10), "TimeCritical": (15, -20)}
+    """priority names with the Windows thread priority and the Linux nice value"""
+
+
+    def __init__(self):
+        self.workers = None
+        """number of worker threads (None: number of cpu cores)"""
+        self.cpus = {role: None for role in self.roles}
+        self.priority = {role: None for role in self.roles}
+
+
+    def set(self, role: str, cpus: typing.Optional[typing.List[int]] = None, priority: typing.Optional[str] = None):
+        if role not in self.roles:
+            raise ValueError(f"unknown thread role: {role}")
+        if priority is not None and priority not in self.priorities:
+            raise ValueError(f"unknown thread priority: {priority}")
+        self.cpus[role] = sorted(set(cpus)) if cpus else None
+        self.priority[role] = priority
+
+
+    def numWorkers(self):
+        return self.workers or os.cpu_count() or 1
+
+
+    def isPinned(self, role: str):
+        return self.cpus.get(role) is not None
+
+
+    def load(self, path: str):
+        """
+Reads the [Threads] section of an ini file. Returns False if the file has no valid section. An invalid entry
+raises a ValueError and leaves all settings unchanged.
+
+        """
+        parser = configparser.ConfigParser(inline_comment_prefixes=('#', ';'))
+        try:
+            parser.read(path)
+        except configparser.Error:
+            return False
+        if not parser.has_section("Threads"):
+            return False
+        section = parser["Threads"]
+        # the section is read into new settings, so a bad entry does not leave them half changed
+        loaded = ThreadSettings()
+        if section.get("Workers"):
+            loaded.workers = int(section["Workers"])
+        for role in self.roles:
+            cpus = section.get(role + "Cpus")
+            priority = section.get(role + "Priority")
+            if cpus or priority:
+                loaded.set(role, parseCpus(cpus) if cpus else None, priority or None)
+        self.workers, self.cpus, self.priority = loaded.workers, loaded.cpus, loaded.priority
+        return True
+
+
+    def apply(self, role: str):
+        """
+Applies the affinity and the priority of the `role` to the calling thread. Returns False if the operating
+system refused them (e.g. a higher priority without the rights for it).
+
+        """
+        ok = True
+        cpus = self.cpus.get(role)
+        priority = self.priority.get(role)
+        try:
+            if os.name == 'nt':
+                kernel32 = ct.windll.kernel32
+                thread = kernel32.GetCurrentThread()
+                if cpus is not None:
+                    kernel32.SetThreadAffinityMask.argtypes = [ct.c_void_p, ct.c_size_t]
+                    ok &= kernel32.SetThreadAffinityMask(thread, sum(1 << c for c in cpus)) != 0
+                if priority is not None:
+                    ok &= kernel32.SetThreadPriority(thread, self.priorities[priority][0]) != 0
+            else:
+                # on Linux affinity and nice value are per thread (task)
+                if cpus is not None and hasattr(os, 'sched_setaffinity'):
+                    os.sched_setaffinity(0, cpus)
+                if priority is not None and hasattr(os, 'setpriority'):
+                    os.setpriority(os.PRIO_PROCESS, threading.get_native_id(), self.priorities[priority][1])
+        except (OSError, AttributeError):
+            ok = False
+        return bool(ok)
+
+
+def parseCpus(text: str):
+    """
+Returns the list of CPUs of a text like '0-3,8,10'.
+
+    """
+    cpus = []
+    for part in text.replace(' ', '').split(','):
+        if '-' in part:
+            first, last = part.split('-')
+            cpus += range(int(first), int(last) + 1)
+        elif part:
+            cpus.append(int(part))
+    return cpus
+
+
+threadSettings = ThreadSettings()
+"""threading model of the threads of snAPI (see :class:`ThreadSettings`)"""
+
+
+def workerInit():
+    """
+Applies the 'Worker' thread settings, used as the initializer of the thread pools.
+
+    """
+    threadSettings.apply("Worker")
+
+
+class BufferPool:
+    """
+This is a pool of the large buffers of the measurement classes (e.g. the data arrays of :meth:`snAPI.Main.Raw.measure`
+and :meth:`snAPI.Main.Unfold.measure`). Without the pool every measurement allocates and zero-fills new arrays,
+which touches every page of up to some GB before any data arrives. With the pool each buffer is kept after the
+measurement and given to the next measurement of the same owner (or any other one that fits), so repeated
+measurements do not allocate at all. New buffers are memory-mapped, so their pages are not zero-filled by
+Python, and with `largePages` they are backed by large pages (Windows: MEM_LARGE_PAGES, needs the 'Lock pages in
+memory' right; Linux: transparent huge pages). With `prefault` all pages are touched at the allocation, so the
+first measurement does not page-fault either. A buffer that leaves the pool (when the pool is disabled) is freed as
+soon as no array uses it anymore, also the locked large pages.
+
+Warning
+-------
+    The arrays of a measurement are reused by the next one. Views returned by `getData` of a previous
+    measurement are overwritten, copy them if they are needed afterwards.
+
+    """
+
+    alignment = 1 << 21
+    """buffers are allocated in multiples of 2MB (the size of large pages)"""
+
+
+    def __init__(self):
+        self.enabled = False
+        self.largePages = False
+        self.prefault = False
+        self.owned = {}
+        self.free = []
+        self.numAllocs = 0
+        self.numReuses = 0
+        self.lock = threading.Lock()
+
+
+    def configure(self, enabled: bool, largePages: bool = False, prefault: bool = False):
+        with self.lock:
+            self.enabled = enabled
+            self.largePages = largePages
+            self.prefault = prefault
+            if not enabled:
+                self.owned = {}
+                self.free = []
+
+
+    def array(self, ctype, length: int, owner: str, zero: bool = False):
+        """
+Returns a ctypes array of `length` elements of `ctype` for the `owner` (e.g. 'Raw.data'). The previous array
+of the owner goes back to the pool. The array is zeroed if `zero` is set.
+
+        """
+        if not self.enabled:
+            return ct.ARRAY(ctype, length)()
+        size = max(ct.sizeof(ctype) * length, 1)
+        with self.lock:
+            buf = self.owned.pop(owner, None)
+            if buf is not None:
+                self.free.append(buf)
+            fitting = [b for b in self.free if len(b) >= size]
+            if fitting:
+                buf = min(fitting, key=len)
+                self.free.remove(buf)
+                self.numReuses += 1
+            else:
+                buf = self._allocate(size + (-size % self.alignment))
+                self.numAllocs += 1
+            self.owned[owner] = buf
+        array = ct.ARRAY(ctype, length).from_buffer(buf)
+        if zero:
+            ct.memset(array, 0, size)
+        return array
+
+
+    def getStats(self):
+        with self.lock:
+            return {"Enabled": self.enabled, "NumAllocs": self.numAllocs, "NumReuses": self.numReuses,
+                    "OwnedBytes": sum(len(b) for b in self.owned.values()), "FreeBytes": sum(len(b) for b in self.free)}
+
+
+    def _allocate(self, size):
+        if os.name == 'nt' and self.largePages:
+            buf = self._allocateLargePages(size)
+            if buf is not None:
+                return buf
+        buf = mmap.mmap(-1, size)
+        if self.largePages and hasattr(buf, 'madvise') and hasattr(mmap, 'MADV_HUGEPAGE'):
+            buf.madvise(mmap.MADV_HUGEPAGE)
+        if self.prefault:
+            # touching one byte per page maps all pages
+            np.frombuffer(buf, dtype=np.uint8)[::mmap.PAGESIZE] = 0
+        return buf
+
+
+    @staticmethod
+    def _allocateLargePages(size):
+        MEM_COMMIT, MEM_RESERVE, MEM_LARGE_PAGES, PAGE_READWRITE = 0x1000, 0x2000, 0x20000000, 0x04
+        kernel32 = ct.windll.kernel32
+        kernel32.GetLargePageMinimum.restype = ct.c_size_t
+        minimum = kernel32.GetLargePageMinimum()
+        if not minimum:
+            return None
+        size += -size % minimum
+        kernel32.VirtualAlloc.restype = ct.c_void_p
+        kernel32.VirtualAlloc.argtypes = [ct.c_void_p, ct.c_size_t, ct.c_uint32, ct.c_uint32]
+        address = kernel32.VirtualAlloc(None, size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE)
+        if not address:
+            return None
+        return _largePages(size).from_address(address)
+
+
+def _largePages(size):
+    # the locked large pages are given back with VirtualFree when the last array on them is gone (the arrays of
+    # :meth:`BufferPool.array` and their numpy views keep the buffer alive)
+    MEM_RELEASE = 0x8000
+
+    def release(self):
+        kernel32 = ct.windll.kernel32
+        kernel32.VirtualFree.argtypes = [ct.c_void_p, ct.c_size_t, ct.c_uint32]
+        kernel32.VirtualFree(ct.addressof(self), 0, MEM_RELEASE)
+
+    return type("LargePages", (ct.c_char * size,), {"__del__": release})
+
+
+bufferPool = BufferPool()
+"""pool of the measurement buffers (see :class:`BufferPool`)"""
+
+
+class BlockRing:
+    """
+This is a single-producer/single-consumer ring of fixed-size blocks. It is used by the stream functions
+of the :class:`snAPI.Main.Raw` and :class:`snAPI.Main.Unfold` classes to take the blocks from the API
+without an additional copy.
+
+The producer thread reserves the next free block and lets the API write directly into it. The consumer
+acquires the oldest committed block as numpy views onto the ring memory and releases it when done.
+Each side only advances its own cursor, so no lock is needed between them.
+
+Parameters
+----------
+    types: List[ctypes type]
+        | one ctypes type for each column (e.g. [ct.c_uint64, ct.c_uint8] for times and channels)
+    blockSize: int
+        | number of records per block
+    numBlocks: int
+        | number of blocks in the ring
+
+    """
+
+    def __init__(self, types, blockSize, numBlocks):
+        self.blockSize = blockSize
+        self.numBlocks = numBlocks
+        self.types = types
+        self.columns = None
+        self.views = None
+        # a pinned reader allocates the ring itself, so the memory is local to its NUMA node
+        if not threadSettings.isPinned("Reader"):
+            self.allocate()
+        self.lengths = [0] * numBlocks
+        self.scratch = None
+        self.head = 0
+        """number of committed blocks (written by the producer only)"""
+        self.tail = 0
+        """number of released blocks (written by the consumer only)"""
+        self.acquired = False
+        """True while the consumer holds the block returned by :meth:`acquire`"""
+        self.numDropped = 0
+        """number of records that were dropped because the ring was full"""
+        self.highWater = 0
+        """maximum number of blocks that were filled at the same time"""
+        self.running = False
+        self.thread = None
+
+
+    def allocate(self):
+        """
+Allocates the memory of the ring (the memory is touched by the calling thread).
+
+        """
+        if self.columns is None:
+            self.columns = [ct.ARRAY(t, self.blockSize * self.numBlocks)() for t in self.types]
+            self.views = [np.ctypeslib.as_array(c) for c in self.columns]
+
+
+    def numFilled(self):
+        """
+Returns the number of committed blocks that are not yet released by the consumer.
+
+        """
+        return self.head - self.tail
+
+
+    def reserve(self):
+        """
+Returns pointers to the next free block for each column or `None` if the ring is full.
+
+        """
+        if self.numFilled() >= self.numBlocks:
+            return None
+        offset = (self.head % self.numBlocks) * self.blockSize
+        return [ct.byref(c, offset * ct.sizeof(c._type_)) for c in self.columns]
+
+
+    def commit(self, length: int):
+        """
+Publishes the reserved block with `length` valid records to the consumer.
+
+        """
+        self.lengths[self.head % self.numBlocks] = length
+        self.head += 1
+        self.highWater = max(self.highWater, self.numFilled())
+
+
+    def acquire(self):
+        """
+Returns the oldest committed block as a list of numpy views (one per column) or `None` if the ring is empty.
+The views stay valid until :meth:`release` is called.
+
+        """
+        if self.tail == self.head:
+            return None
+        self.acquired = True
+        slot = self.tail % self.numBlocks
+        offset = slot * self.blockSize
+        length = self.lengths[slot]
+        return [v[offset:offset + length] for v in self.views]
+
+
+    def release(self):
+        """
+Gives the acquired block back to the producer. Nothing is released if :meth:`acquire` returned no block, so a
+block committed in between is not lost.
+
+        """
+        if self.acquired:
+            self.acquired = False
+            self.tail += 1
+
+
+    def startProducer(self, fetch, isFinished, pollTime: float, dropOnFull: bool, onBlock=None, onEnd=None):
+        """
+Starts the producer thread. It calls `fetch(pointers)` every `pollTime` ms, which has to fill the given block
+pointers and return the number of records written. If the ring is full and `dropOnFull` is set, the block is
+fetched into a scratch buffer and counted in :obj:`numDropped`, otherwise the producer waits for the consumer.
+Every fetched block (also a dropped one) is passed to `onBlock(views)` on the producer thread if given.
+The thread ends after the last fetch once `isFinished()` returned True and calls `onEnd()` if given.
+
+        """
+        def run():
+            threadSettings.apply("Reader")
+            self.allocate()
+            while self.running:
+                finished = isFinished()
+                ptrs = self.reserve()
+                if ptrs is not None:
+                    length = fetch(ptrs)
+                    if length > 0:
+                        if onBlock is not None:
+                            offset = (self.head % self.numBlocks) * self.blockSize
+                            onBlock([v[offset:offset + length] for v in self.views])
+                        self.commit(length)
+                elif dropOnFull:
+                    if self.scratch is None:
+                        self.scratch = [ct.ARRAY(c._type_, self.blockSize)() for c in self.columns]
+                    length = fetch([ct.byref(c) for c in self.scratch])
+                    if length > 0 and onBlock is not None:
+                        onBlock([np.ctypeslib.as_array(c)[:length] for c in self.scratch])
+                    self.numDropped += length
+                else:
+                    finished = False
+                if finished:
+                    break
+                time.sleep(pollTime / 1000)
+            self.running = False
+            if onEnd is not None:
+                onEnd()
+
+        self.running = True
+        self.thread = threading.Thread(target=run, daemon=True)
+        self.thread.start()
+
+
+    def stopProducer(self):
+        """
+Stops the producer thread and waits for it.
+
+        """
+        self.running = False
+        if self.thread is not None and self.thread is not threading.current_thread():
+            self.thread.join()
+        self.thread = None
+
+
+
+def histPairs(stops, starts, window: float, binWidth: float, hist, maxPairs: int = 1 << 22):
+    """
+Adds the time differences `stop - start` of all pairs of the sorted arrays `stops` and `starts` that lie
+within [-window, window) to the histogram `hist` with bins of `binWidth`. The pairs are evaluated in chunks
+of at most `maxPairs` to limit the temporary memory.
+
+Parameters
+----------
+    stops: 1DArray[int]
+        sorted times of the stop events [ps]
+    starts: 1DArray[int]
+        sorted times of the start events [ps]
+    window: float
+        size of the correlation window [ps]
+    binWidth: float
+        width of the bins [ps]
+    hist: 1DArray[int]
+        histogram of 2*window/binWidth bins the pairs are added to
+    maxPairs: int
+        maximum number of pairs per chunk
+
+    """
+    if not len(stops) or not len(starts):
+        return
+    numBins = len(hist)
+    # the integer borders are a bit wider, the exact borders are given by the bins
+    lo = np.searchsorted(starts, stops - (int(window) + 1), 'right')
+    hi = np.searchsorted(starts, stops + (int(window) + 1), 'right')
+    counts = hi - lo
+    cum = np.cumsum(counts)
+    first = 0
+    while first < len(stops):
+        base = cum[first - 1] if first else 0
+        last = max(int(np.searchsorted(cum, base + maxPairs, 'right')), first + 1)
+        chunk = counts[first:last]
+        num = int(chunk.sum())
+        if num:
+            offsets = np.cumsum(chunk) - chunk
+            stopIdx = np.repeat(np.arange(first, last), chunk)
+            startIdx = np.arange(num) + np.repeat(lo[first:last] - offsets, chunk)
+            bins = np.floor((stops[stopIdx] - starts[startIdx] + window) / binWidth).astype(np.int64)
+            bins = bins[(bins >= 0) & (bins < numBins)]
+            hist += np.bincount(bins, minlength=numBins)
+        first = last
+
+
+# ptu tag types
+tyEmpty8      = 0xFFFF0008
+tyBool8       = 0x00000008
+tyInt8        = 0x10000008
+tyBitSet64    = 0x11000008
+tyColor8      = 0x12000008
+tyFloat8      = 0x20000008
+tyTDateTime   = 0x21000008
+tyFloat8Array = 0x2001FFFF
+tyAnsiString  = 0x4001FFFF
+tyWideString  = 0x4002FFFF
+tyBinaryBlob  = 0xFFFFFFFF
+
+
+def gateIndex(heralds, times, delayTime: float, gateTime: float):
+    """
+Returns for each of the `times` the index of the herald in the sorted `heralds` whose gate (from
+`delayTime` to `delayTime` + `gateTime` after the herald) contains it, or -1. An event can only be inside the
+gate of the latest herald before it minus the `delayTime`, so the gates of all channels are resolved by one
+merge of the two sorted arrays.
+
+Parameters
+----------
+    heralds: 1DArray[int]
+        sorted times of the herald events [ps] (:obj:`.MeasMode.T3` times have to be sorted first, the dTimes of
+        one sync period are not strictly ordered)
+    times: 1DArray[int]
+        times of the gated events [ps]
+    delayTime: float
+        time between the herald and the start of its gate [ps]
+    gateTime: float
+        length of the gate [ps]
+
+Returns
+-------
+    indices: 1DArray[int]
+
+    """
+    opened = times - int(delayTime)
+    idx = np.searchsorted(heralds, opened, 'right') - 1
+    inside = (idx >= 0) & (heralds[np.maximum(idx, 0)] > opened - int(gateTime)) if len(heralds) else np.zeros(len(times), dtype=bool)
+    return np.where(inside, idx, -1)
+
+
+def readPTUHeader(path: str):
+    """
+Reads the tags of a ptu file header. Indexed tags are stored as 'Name(Index)'.
+
+Parameters
+----------
+    path: str
+        path of the ptu file
+
+Returns
+-------
+    tuple [dict, int]
+        tags: dict
+            all tags of the header by name
+        offset: int
+            file position of the first record
+
+    """
+    tags = {}
+    with open(path, 'rb') as f:
+        if f.read(8).rstrip(b'\0') != b'PQTTTR':
+            raise ValueError(f"{path} is not a ptu file")
+        f.read(8) # version
+        while True:
+            head = f.read(48)
+            if len(head) < 48:
+                raise ValueError(f"{path} has no complete header")
+            ident, idx, tagType, raw = struct.unpack('<32siI8s', head)
+            ident = ident.split(b'\0')[0].decode('latin-1')
+            if tagType in (tyInt8, tyBool8, tyBitSet64, tyColor8):
+                value = struct.unpack('<q', raw)[0]
+            elif tagType in (tyFloat8, tyTDateTime):
+                value = struct.unpack('<d', raw)[0]
+            elif tagType == tyEmpty8:
+                value = None
+            else:
+                data = f.read(struct.unpack('<q', raw)[0])
+                if tagType == tyAnsiString:
+                    value = data.split(b'\0')[0].decode('latin-1')
+                elif tagType == tyWideString:
+                    value = data.decode('utf-16-le').split('\0')[0]
+                elif tagType == tyFloat8Array:
+                    value = np.frombuffer(data, dtype='<f8')
+                else:
+                    value = data
+            tags[ident if idx == -1 else f"{ident}({idx})"] = value
+            if ident == "Header_End":
+                return tags, f.tell()
+
+
+def writePTUHeader(tags: dict):
+    """
+Builds a ptu file header of the `tags` (like the ones returned by :func:`readPTUHeader`). The tag types are taken
+from the values (bool, int, float, str, bytes, float arrays and None for empty tags) and 'Header_End' is added.
+
+Returns
+-------
+    tuple [bytes, dict]
+        header: bytes
+            the header
+        offsets: dict
+            positions of the values in the header by tag name (e.g. to update TTResult_NumberOfRecords at the end)
+
+    """
+    out = bytearray(b'PQTTTR\0\0' + b'1.0.00\0\0')
+    offsets = {}
+    for name, value in list(tags.items()) + [("Header_End", None)]:
+        ident, idx = name, -1
+        if name.endswith(")") and "(" in name:
+            ident, idx = name[:-1].split("(")
+            idx = int(idx)
+        data = b''
+        if value is None:
+            tagType, raw = tyEmpty8, bytes(8)
+        elif isinstance(value, bool):
+            tagType, raw = tyBool8, struct.pack('<q', -1 if value else 0)
+        elif isinstance(value, (int, np.integer)):
+            tagType, raw = tyInt8, struct.pack('<q', int(value))
+        elif isinstance(value, (float, np.floating)):
+            tagType, raw = tyFloat8, struct.pack('<d', float(value))
+        elif isinstance(value, str):
+            data = value.encode('latin-1') + b'\0'
+            data += bytes(-len(data) % 8)
+            tagType, raw = tyAnsiString, struct.pack('<q', len(data))
+        elif isinstance(value, np.ndarray):
+            data = value.astype('<f8').tobytes()
+            tagType, raw = tyFloat8Array, struct.pack('<q', len(data))
+        else:
+            data = bytes(value)
+            tagType, raw = tyBinaryBlob, struct.pack('<q', len(data))
+        offsets[name] = len(out) + 40
+        out += struct.pack('<32siI8s', ident.encode('latin-1'), idx, tagType, raw) + data
+    return bytes(out), offsets
+
+
+class PTUWriter:
+    """
+This writes a ptu file on its own I/O thread, so the acquisition does not wait for the disk. The records are
+copied into a pool of `queueDepth` page-aligned buffers of `bufferSize` bytes, and full buffers are queued to the
+I/O thread, which writes each one in a single call. Only if all buffers of the pool are waiting for the disk
+:meth:`write` blocks (counted in :obj:`numStalls`).
+
+On Linux the file is opened with O_DIRECT (if the file system supports it), so the data bypasses the page cache.
+Otherwise the writes go through the cache and the data is flushed to the disk with fsync every `syncEvery` buffers
+(write-behind). At :meth:`close` the file is cut to its real length and TTResult_NumberOfRecords is updated.
+
+After the first failed write the I/O thread stops writing (the later data would leave a hole in the file). The
+error is kept in :obj:`error` and :meth:`close` returns False, the file holds the data up to the error.
+
+Note
+----
+    It is used by :meth:`snAPI.Main.Raw.startStream`. The other measurements (`savePTU` of `measure` and the
+    streams of :class:`snAPI.Main.Unfold`) write their ptu files inside the API.
+
+Parameters
+----------
+    path: str
+        | path of the ptu file
+    tags: dict
+        | tags of the header (see :func:`writePTUHeader`)
+    bufferSize: int
+        | size of one buffer [bytes] (a multiple of the page size)
+    queueDepth: int
+        | number of buffers in the pool
+    direct: bool
+        | use unbuffered writes if possible
+    syncEvery: int
+        | number of buffers between two fsync (0: only at the end)
+
+    """
+
+    def __init__(self, path: str, tags: dict, bufferSize: int = 1 << 22, queueDepth: int = 16, direct: bool = True, syncEvery: int = 16):
+        self.path = path
+        self.bufferSize = max(mmap.PAGESIZE, bufferSize - bufferSize % mmap.PAGESIZE)
+        self.syncEvery = syncEvery
+        tags = dict(tags)
+        tags.setdefault("TTResult_NumberOfRecords", 0)
+        header, self.offsets = writePTUHeader(tags)
+        self.header = header
+        self.buffers = [mmap.mmap(-1, self.bufferSize) for _ in range(max(queueDepth, 2))]
+        self.free = queue.Queue()
+        for buf in self.buffers:
+            self.free.put(np.frombuffer(buf, dtype=np.uint8))
+        self.filled = queue.Queue()
+        flags = os.O_WRONLY | os.O_CREAT | os.O_TRUNC | getattr(os, 'O_BINARY', 0)
+        self.direct = False
+        if direct and hasattr(os, 'O_DIRECT'):
+            try:
+                self.fd = os.open(path, flags | os.O_DIRECT)
+                self.direct = True
+            except OSError:
+                pass
+        if not self.direct:
+            self.fd = os.open(path, flags)
+        self.current = None
+        self.fill = 0
+        self.numRecords = 0
+        self.numBytes = 0
+        """number of bytes written to the disk"""
+        self.numStalls = 0
+        """number of times :meth:`write` had to wait for a free buffer"""
+        self.peakQueue = 0
+        """maximum number of buffers that were waiting for the disk"""
+        self.error = None
+        """first OSError of the I/O thread"""
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+        self._copy(np.frombuffer(header, dtype=np.uint8))
+
+
+    def write(self, records):
+        """
+Appends the `records` (uint32) to the file.
+
+        """
+        records = np.ascontiguousarray(records, dtype=np.uint32)
+        self.numRecords += len(records)
+        self._copy(records.view(np.uint8))
+
+
+    def close(self):
+        """
+Writes the rest of the data, waits for the I/O thread and updates the header.
+
+Returns
+-------
+    True: the whole data was written
+    False: a write failed (see :obj:`error`)
+
+        """
+        if self.thread is None:
+            return self.error is None
+        if self.fill:
+            self._queue()
+        self.filled.put(None)
+        self.thread.join()
+        self.thread = None
+        try:
+            os.ftruncate(self.fd, self.numBytes)
+            os.close(self.fd)
+            if self.numBytes >= self.offsets["TTResult_NumberOfRecords"] + 8:
+                # only the records that reached the file are counted
+                numRecords = self.numRecords if self.error is None else max(self.numBytes - len(self.header), 0) // 4
+                with open(self.path, 'r+b') as f:
+                    f.seek(self.offsets["TTResult_NumberOfRecords"])
+                    f.write(struct.pack('<q', numRecords))
+                    f.flush()
+                    os.fsync(f.fileno())
+        except OSError as e:
+            self.error = self.error or e
+        # the views onto the buffers have to be gone before the buffers are closed
+        self.free = self.filled = self.current = None
+        for buf in self.buffers:
+            buf.close()
+        return self.error is None
+
+
+    def _copy(self, data):
+        pos = 0
+        while pos < len(data):
+            if self.current is None:
+                if self.free.empty():
+                    self.numStalls += 1
+                self.current = self.free.get()
+                self.fill = 0
+            num = min(len(data) - pos, self.bufferSize - self.fill)
+            self.current[self.fill:self.fill + num] = data[pos:pos + num]
+            self.fill += num
+            pos += num
+            if self.fill == self.bufferSize:
+                self._queue()
+
+
+    def _queue(self):
+        self.filled.put((self.current, self.fill))
+        self.peakQueue = max(self.peakQueue, self.filled.qsize())
+        self.current = None
+        self.fill = 0
+
+
+    def _run(self):
+        threadSettings.apply("Writer")
+        numWrites = 0
+        while True:
+            item = self.filled.get()
+            if item is None:
+                break
+            buf, length = item
+            if self.error is not None:
+                # nothing is written after an error, the buffers only go back to the pool
+                self.free.put(buf)
+                continue
+            try:
+                # unbuffered writes need whole pages, the file is cut to its length at the end
+                end = length + (-length % mmap.PAGESIZE) if self.direct else length
+                pos = 0
+                while pos < end:
+                    num = os.write(self.fd, buf[pos:end])
+                    if num <= 0:
+                        raise OSError(f"write to {self.path} returned {num}")
+                    pos += num
+                    if self.direct and pos < end and pos % mmap.PAGESIZE:
+                        # the rest of a short unbuffered write is not aligned anymore, it goes through the cache
+                        self._clearDirect()
+                self.numBytes += length
+                numWrites += 1
+                if self.syncEvery and numWrites % self.syncEvery == 0 and not self.direct:
+                    os.fsync(self.fd)
+            except OSError as e:
+                self.error = e
+            self.free.put(buf)
+        if not self.direct and self.error is None:
+            try:
+                os.fsync(self.fd)
+            except OSError as e:
+                self.error = e
+
+
+    def _clearDirect(self):
+        import fcntl
+        fcntl.fcntl(self.fd, fcntl.F_SETFL, fcntl.fcntl(self.fd, fcntl.F_GETFL) & ~os.O_DIRECT)
+        self.direct = False
+
+
+def recordType(model: str, isT3: bool, version: str = ""):
+    """
+Returns the TTResultFormat_TTTRRecType of the records of a device `model` (e.g. deviceConfig["Model"]) in T2 or T3
+mode. The HydraHarp 400 with a firmware `version` 1.x has the record format of version 1. An unknown model gets the
+record type of the MultiHarp.
+
+    """
+    model = (model or "").replace(" ", "").lower()
+    if model.startswith("picoharp300"):
+        recType = 0x00010203
+    elif model.startswith("picoharp330"):
+        recType = 0x00010208
+    elif model.startswith("hydraharp"):
+        recType = 0x00010204 if str(version).startswith("1") else 0x01010204
+    elif model.startswith("timeharp260n"):
+        recType = 0x00010205
+    elif model.startswith("timeharp260p"):
+        recType = 0x00010206
+    else:
+        recType = 0x00010207
+    return recType + 0x100 if isT3 else recType
+
+
+class RecordDecoder:
+    """
+This decodes the T2 and T3 records of the HydraHarp, MultiHarp, TimeHarp 260 and PicoHarp 330 into the `Unfold`
+format (64 bit timetags and 8 bit channels, 0: sync, 0x80: marker flag). All records of a block are decoded at once
+with numpy. The overflow records are removed, and their counts are added up with a prefix sum, so the decoding of a
+block only needs the number of overflows before it (`carry`). This lets the blocks of a file be decoded in parallel.
+
+Parameters
+----------
+    recType: int
+        TTResultFormat_TTTRRecType of the ptu header
+    globalResolution: float
+        MeasDesc_GlobalResolution of the ptu header [s] (the T2 timetags are converted to ps with it)
+
+    """
+
+    def __init__(self, recType: int, globalResolution: float):
+        mode = (recType >> 8) & 0xFF
+        if recType in (0x00010203, 0x00010303) or mode not in (0x02, 0x03):
+            raise ValueError(f"record type 0x{recType:08X} is not supported")
+        self.recType = recType
+        self.isT3 = mode == 0x03
+        self.oneOverflow = recType in (0x00010204, 0x00010304)
+        if self.isT3:
+            self.wrap = 1024
+            self.mask = 0x3FF
+        else:
+            self.wrap = 33552000 if self.oneOverflow else 33554432
+            self.mask = 0x1FFFFFF
+        self.timeFactor = globalResolution * 1e12
+        self.carry = 0
+        """number of overflows of the blocks decoded by :meth:`decodeNext`"""
+
+
+    def overflowCounts(self, records):
+        """
+Returns the number of overflows of each record (0 for all other records).
+
+        """
+        isOverflow = (records >> 25) == 0x7F
+        if self.oneOverflow:
+            return isOverflow.astype(np.int64)
+        counts = (records & self.mask).astype(np.int64)
+        # an overflow record with a count of 0 stands for one overflow
+        counts[counts == 0] = 1
+        return np.where(isOverflow, counts, 0)
+
+
+    def numOverflows(self, records):
+        """
+Returns the sum of all overflows of the `records`.
+
+        """
+        isOverflow = (records >> 25) == 0x7F
+        if self.oneOverflow:
+            return int(np.count_nonzero(isOverflow))
+        counts = records[isOverflow] & self.mask
+        return int(counts.sum(dtype=np.int64) + np.count_nonzero(counts == 0))
+
+
+    def decodeNext(self, records):
+        """
+Decodes the next block of a record stream. The number of overflows is kept in :obj:`carry` from one block to the
+next, so the blocks of a running measurement can be decoded one after the other.
+
+        """
+        times, channels = self.decode(records, self.carry)
+        self.carry += self.numOverflows(records)
+        return times, channels
+
+
+    def decode(self, records, carry: int = 0):
+        """
+Decodes a block of records.
+
+Parameters
+----------
+    records: 1DArray[uint32]
+        the records
+    carry: int
+        number of overflows before the first record
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: 1DArray[uint64]
+            `Unfold` timetags (T2: [ps], T3: nSync << 15 | dTime)
+        channels: 1DArray[uint8]
+            `Unfold` channels
+
+        """
+        top = records >> 25
+        isOverflow = top == 0x7F
+        overflowIdx = np.flatnonzero(isOverflow)
+        if len(overflowIdx):
+            # the prefix sum only runs over the (rare) overflow records, every segment of events between two
+            # overflows gets the same count
+            counts = np.ones(len(overflowIdx), dtype=np.int64)
+            if not self.oneOverflow:
+                counts = (records[overflowIdx] & self.mask).astype(np.int64)
+                counts[counts == 0] = 1
+            keep = ~isOverflow
+            records = records[keep]
+            top = top[keep]
+            segments = np.diff(overflowIdx, prepend=-1, append=len(isOverflow)) - 1
+            overflows = np.repeat(np.concatenate(([carry], carry + np.cumsum(counts))), segments).astype(np.uint64)
+        else:
+            overflows = np.full(len(records), carry, dtype=np.uint64)
+        top = top.astype(np.uint8)
+        special = top >= 0x40
+        chan = top & 0x3F
+        channels = np.where(special, 0x80 | chan, chan + 1).astype(np.uint8)
+        if self.isT3:
+            nSync = overflows * np.uint64(1024) + (records & 0x3FF)
+            times = (nSync << np.uint64(15)) | ((records >> 10) & 0x7FFF).astype(np.uint64)
+        else:
+            # special records with channel 0 are sync events
+            channels[special & (chan == 0)] = 0
+            tags = overflows * np.uint64(self.wrap) + (records & self.mask)
+            if abs(self.timeFactor - round(self.timeFactor)) < 1e-6:
+                times = tags * np.uint64(round(self.timeFactor))
+            else:
+                times = np.rint(tags * self.timeFactor).astype(np.uint64)
+        return times, channels
+
+
+def unfoldToPs(times, isT3: bool, syncPeriod: float, resolution: float):
+    """
+Converts `Unfold` timetags into absolute times [ps]. In T3 the times are calculated from the sync counter
+and the dTime with the `syncPeriod` [ps] and the dTime `resolution` [ps].
+
+    """
+    times = times.astype(np.int64)
+    if isT3:
+        nSync = (times >> 15).astype(np.float64)
+        dTime = (times & 0x7FFF).astype(np.float64)
+        return np.rint(nSync * syncPeriod + dTime * resolution).astype(np.int64)
+    return times
+
+
+def psToUnfold(times, isT3: bool, syncPeriod: float, resolution: float):
+    """
+Converts absolute times [ps] back into `Unfold` timetags (the inverse of :func:`unfoldToPs`).
+
+    """
+    times = np.asarray(times, dtype=np.int64)
+    if isT3:
+        nSync = np.floor(times / syncPeriod)
+        dTime = np.clip(np.rint((times - nSync * syncPeriod) / resolution), 0, 0x7FFF)
+        return (nSync.astype(np.uint64) << np.uint64(15)) | dTime.astype(np.uint64)
+    return times.astype(np.uint64)
+
+
+class PTUFile:
+    """
+This gives access to the records of a ptu file without reading it. The records are memory-mapped, and a sparse
+index holds the number of overflows before every `indexStep` records. With it every block of records can be
+decoded independently, and a time range can be found without decoding the file from the start.
+Optionally the index is cached next to the file ('<file>.idx.npz') or in a cache directory and is reused as
+long as the file is unchanged (see :meth:`buildIndex`).
+
+Parameters
+----------
+    path: str
+        path of the ptu file
+
+    """
+
+    indexStep = 65536
+    """number of records between two index entries"""
+
+
+    def __init__(self, path: str):
+        self.path = path
+        self.tags, self.offset = readPTUHeader(path)
+        self.decoder = RecordDecoder(self.tags["TTResultFormat_TTTRRecType"], self.tags["MeasDesc_GlobalResolution"])
+        numRecords = (os.path.getsize(path) - self.offset) // 4
+        if self.tags.get("TTResult_NumberOfRecords"):
+            numRecords = min(numRecords, self.tags["TTResult_NumberOfRecords"])
+        if numRecords:
+            self.records = np.memmap(path, dtype=np.uint32, mode='r', offset=self.offset, shape=(numRecords,))
+        else:
+            self.records = np.zeros(0, dtype=np.uint32)
+        syncRate = self.tags.get("TTResult_SyncRate", 0)
+        self.syncPeriod = 1e12 / syncRate if syncRate else 0.0
+        """sync period [ps]"""
+        self.resolution = self.tags.get("MeasDesc_Resolution", 1e-12) * 1e12
+        """dTime resolution [ps]"""
+        if self.decoder.isT3:
+            self.overflowTime = self.decoder.wrap * self.syncPeriod
+        else:
+            self.overflowTime = self.decoder.wrap * self.decoder.timeFactor
+        """time of one overflow [ps]"""
+        self.carries = None
+        """number of overflows before every index block (one more entry for the end of the file)"""
+
+
+    def numRecords(self):
+        return len(self.records)
+
+
+    def numBlocks(self):
+        return (len(self.records) + self.indexStep - 1) // self.indexStep
+
+
+    def buildIndex(self, pool=None, cache: typing.Union[bool, str] = False):
+        """
+Builds the index or loads it from the cache. The blocks are counted on the thread `pool` if given.
+
+Parameters
+----------
+    pool: ThreadPoolExecutor
+        threads that count the blocks
+    cache: bool or str
+        | False: the index is not stored
+        | True: the index is stored next to the file ('<file>.idx.npz')
+        | str: directory the index is stored in (e.g. if the data is on a read-only share)
+
+        """
+        if cache is True:
+            sidecar = self.path + ".idx.npz"
+        elif cache:
+            # the path is part of the name, so files with the same name in different directories do not collide
+            name = f"{os.path.basename(self.path)}.{zlib.crc32(os.path.abspath(self.path).encode('utf-8')):08x}.idx.npz"
+            sidecar = os.path.join(cache, name)
+        key = np.array([os.path.getsize(self.path), self.indexStep], dtype=np.int64)
+        guid = str(self.tags.get("File_GUID", ""))
+        if cache:
+            try:
+                with np.load(sidecar) as idx:
+                    if np.array_equal(idx["key"], key) and str(idx["guid"]) == guid:
+                        self.carries = idx["carries"]
+                        return
+            except (OSError, KeyError, ValueError):
+                pass
+
+        blocks = [self.records[i:i + self.indexStep] for i in range(0, len(self.records), self.indexStep)]
+        mapper = pool.map if pool else map
+        self.carries = np.concatenate(([0], np.cumsum(list(mapper(self.decoder.numOverflows, blocks)), dtype=np.int64)))
+        if cache:
+            try:
+                if cache is not True:
+                    os.makedirs(cache, exist_ok=True)
+                with open(sidecar, 'wb') as f:
+                    np.savez(f, key=key, guid=np.array(guid), carries=self.carries)
+            except OSError:
+                pass
+
+
+    def blockRange(self, startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None):
+        """
+Returns the first and the end index block that contain all events between `startTime` and `stopTime` [ps].
+
+        """
+        if self.carries is None:
+            self.buildIndex()
+        # the events of block k are in [carries[k], carries[k+1] + 1) overflows (T3: plus up to one sync period of dTime)
+        bounds = self.carries[:-1] * self.overflowTime
+        first, end = 0, len(bounds)
+        if startTime is not None:
+            first = max(int(np.searchsorted(bounds, startTime - self.overflowTime - self.syncPeriod, 'right')) - 1, 0)
+        if stopTime is not None:
+            end = int(np.searchsorted(bounds, stopTime, 'left'))
+        return first, max(end, first)
+
+
+    def decodeBlocks(self, first: int, end: int, startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None):
+        """
+Decodes the index blocks [first, end) and returns the events between `startTime` and `stopTime` [ps].
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: `Unfold` timetags
+        channels: `Unfold` channels
+
+        """
+        times, channels = self.decoder.decode(self.records[first * self.indexStep:end * self.indexStep], int(self.carries[first]))
+        if startTime is not None or stopTime is not None:
+            ps = unfoldToPs(times, self.decoder.isT3, self.syncPeriod, self.resolution)
+            inside = np.ones(len(ps), dtype=bool)
+            if startTime is not None:
+                inside &= ps >= startTime
+            if stopTime is not None:
+                inside &= ps < stopTime
+            times, channels = times[inside], channels[inside]
+        return times, channels
+
+
+ttzMagic = b'SNTTZ\0\0\0'
+ttzIndexMagic = b'TTZINDEX'
+
+
+def encodeTimes(times):
+    """
+Encodes `Unfold` timetags for the compression: the differences of successive times (zig-zag coded, so small
+negative steps of T3 times stay small) are split into byte planes. Most high bytes are zero and compress well.
+
+    """
+    times = np.asarray(times, dtype=np.uint64).astype(np.int64)
+    diffs = np.diff(times, prepend=times[:1])
+    zigzag = ((diffs << 1) ^ (diffs >> 63)).astype(np.uint64)
+    return np.ascontiguousarray(zigzag.view(np.uint8).reshape(-1, 8).T).tobytes()
+
+
+def decodeTimes(data: bytes, firstTime: int):
+    """
+Decodes the timetags encoded by :func:`encodeTimes` with the first time `firstTime`.
+
+    """
+    planes = np.frombuffer(data, dtype=np.uint8).reshape(8, -1)
+    zigzag = np.ascontiguousarray(planes.T).view(np.uint64).ravel()
+    diffs = (zigzag >> np.uint64(1)).astype(np.int64) ^ -(zigzag & np.uint64(1)).astype(np.int64)
+    return (np.cumsum(diffs) + firstTime).astype(np.uint64)
+
+
+class TTZWriter:
+    """
+This writes `Unfold` data into a compressed container file ('.ttz'). The data is cut into chunks of `chunkSize`
+events, and each chunk is compressed on one of `numThreads` worker threads (delta coding of the times and zlib).
+The chunks are written in order by a separate thread, so :meth:`append` only copies the data. An index of the
+chunks with their time ranges is written at the end, so a reader can seek to any time and decode the chunks in
+parallel (see :class:`TTZFile`). Without the index (e.g. after a crash) the chunks are scanned instead.
+
+Parameters
+----------
+    path: str
+        | path of the file
+    isT3: bool
+        | the times are T3 times (nSync << 15 | dTime)
+    syncPeriod: float
+        | sync period [ps]
+    resolution: float
+        | dTime resolution [ps]
+    baseResolution: float
+        | resolution of the timetags [ps]
+    numChans: int
+        | number of channels including the sync channel
+    chunkSize: int
+        | number of events per chunk
+    numThreads: int
+        | number of compression threads
+    level: int
+        | zlib compression level (1: fastest, 9: smallest)
+
+    """
+
+    def __init__(self, path: str, isT3: bool, syncPeriod: float, resolution: float, baseResolution: float, numChans: int,
+                 chunkSize: int = 1 << 20, numThreads: int = 2, level: int = 1):
+        self.path = path
+        self.isT3 = isT3
+        self.syncPeriod = syncPeriod
+        self.resolution = resolution
+        self.chunkSize = chunkSize
+        self.level = level
+        meta = json.dumps({"IsT3": isT3, "SyncPeriod": syncPeriod, "Resolution": resolution, "BaseResolution": baseResolution,
+                           "NumChans": numChans, "ChunkSize": chunkSize}).encode()
+        self.file = open(path, 'wb')
+        self.file.write(ttzMagic + struct.pack('<II', 1, len(meta)) + meta)
+        self.index = []
+        self.pending = []
+        self.numPending = 0
+        self.numEvents = 0
+        self.numBytes = 0
+        """number of compressed bytes written"""
+        self.pool = concurrent.futures.ThreadPoolExecutor(max(numThreads, 1), initializer=workerInit)
+        self.chunks = queue.Queue()
+        self.error = None
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+
+
+    def append(self, times, channels):
+        """
+Appends a block of `Unfold` data (times, channels).
+
+        """
+        if not len(times):
+            return
+        self.pending.append((np.array(times, dtype=np.uint64), np.array(channels, dtype=np.uint8)))
+        self.numPending += len(times)
+        self.numEvents += len(times)
+        if self.numPending >= self.chunkSize:
+            times = np.concatenate([p[0] for p in self.pending])
+            channels = np.concatenate([p[1] for p in self.pending])
+            full = len(times) - len(times) % self.chunkSize
+            for i in range(0, full, self.chunkSize):
+                self._submit(times[i:i + self.chunkSize], channels[i:i + self.chunkSize])
+            self.pending = [(times[full:], channels[full:])] if full < len(times) else []
+            self.numPending = len(times) - full
+
+
+    def close(self):
+        """
+Compresses the rest of the data, waits for all chunks and writes the index.
+
+Returns
+-------
+    True: the whole data was written
+    False: a chunk could not be compressed or written (see :obj:`error`)
+
+        """
+        if self.thread is None:
+            return self.error is None
+        if self.numPending:
+            self._submit(np.concatenate([p[0] for p in self.pending]), np.concatenate([p[1] for p in self.pending]))
+            self.pending = []
+            self.numPending = 0
+        self.chunks.put(None)
+        self.thread.join()
+        self.thread = None
+        self.pool.shutdown()
+        try:
+            index = np.array(self.index, dtype=np.int64).reshape(-1, 4)
+            offset = self.file.tell()
+            self.file.write(index.tobytes() + struct.pack('<Q', len(index)) + struct.pack('<Q', offset) + ttzIndexMagic)
+            self.file.close()
+        except OSError as e:
+            self.error = self.error or e
+        return self.error is None
+
+
+    def _submit(self, times, channels):
+        self.chunks.put(self.pool.submit(self._encode, times, channels))
+
+
+    def _encode(self, times, channels):
+        ps = unfoldToPs(times, self.isT3, self.syncPeriod, self.resolution)
+        timeData = zlib.compress(encodeTimes(times), self.level)
+        chanData = zlib.compress(np.ascontiguousarray(channels).tobytes(), self.level)
+        head = struct.pack('<QQqqII', len(times), int(times[0]), int(ps.min()), int(ps.max()), len(timeData), len(chanData))
+        return head, timeData, chanData, len(times), int(ps.min()), int(ps.max())
+
+
+    def _run(self):
+        threadSettings.apply("Writer")
+        while True:
+            future = self.chunks.get()
+            if future is None:
+                break
+            try:
+                head, timeData, chanData, num, firstPs, lastPs = future.result()
+                self.index.append((self.file.tell(), num, firstPs, lastPs))
+                self.file.write(head)
+                self.file.write(timeData)
+                self.file.write(chanData)
+                self.numBytes += len(head) + len(timeData) + len(chanData)
+            except (OSError, zlib.error) as e:
+                self.error = self.error or e
+
+
+class TTZFile:
+    """
+This reads the compressed container files written by :class:`TTZWriter`. It has the same interface as
+:class:`PTUFile` for the replay by :meth:`snAPI.Main.Pipeline.startFile`: every index block is one chunk, and
+:meth:`blockRange` finds the chunks of a time range from their time ranges in the index.
+
+Parameters
+----------
+    path: str
+        path of the ttz file
+
+    """
+
+    def __init__(self, path: str):
+        self.path = path
+        self.file = open(path, 'rb')
+        if self.file.read(8) != ttzMagic:
+            raise ValueError(f"{path} is not a ttz file")
+        version, metaLen = struct.unpack('<II', self.file.read(8))
+        meta = json.loads(self.file.read(metaLen))
+        self.offset = 16 + metaLen
+        self.isT3 = meta["IsT3"]
+        self.syncPeriod = meta["SyncPeriod"]
+        """sync period [ps]"""
+        self.resolution = meta["Resolution"]
+        """dTime resolution [ps]"""
+        self.baseResolution = meta["BaseResolution"]
+        self.numChans = meta["NumChans"]
+        self.indexStep = meta["ChunkSize"]
+        """number of events per chunk"""
+        self.tags = {"MeasDesc_Resolution": self.resolution * 1e-12, "HW_InpChannels": self.numChans - 1,
+                     "TTResult_SyncRate": int(round(1e12 / self.syncPeriod)) if self.syncPeriod else 0}
+        self.index = None
+        self.lock = threading.Lock()
+
+
+    def numBlocks(self):
+        if self.index is None:
+            self.buildIndex()
+        return len(self.index)
+
+
+    def buildIndex(self, pool=None, cache: typing.Union[bool, str] = False):
+        """
+Reads the index at the end of the file or scans the chunks if there is none. `cache` is accepted for
+compatibility with :meth:`PTUFile.buildIndex`, the index of a ttz file is stored in the file itself.
+
+        """
+        size = os.path.getsize(self.path)
+        with self.lock:
+            if size >= self.offset + 24:
+                self.file.seek(size - 24)
+                num, offset, magic = struct.unpack('<QQ8s', self.file.read(24))
+                if magic == ttzIndexMagic:
+                    self.file.seek(offset)
+                    self.index = np.frombuffer(self.file.read(num * 32), dtype=np.int64).reshape(-1, 4)
+                    return
+            entries = []
+            pos = self.offset
+            head = struct.calcsize('<QQqqII')
+            while pos + head <= size:
+                self.file.seek(pos)
+                num, firstTime, firstPs, lastPs, timeLen, chanLen = struct.unpack('<QQqqII', self.file.read(head))
+                if pos + head + timeLen + chanLen > size:
+                    break
+                entries.append((pos, num, firstPs, lastPs))
+                pos += head + timeLen + chanLen
+            self.index = np.array(entries, dtype=np.int64).reshape(-1, 4)
+
+
+    def blockRange(self, startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None):
+        """
+Returns the first and the end chunk that contain all events between `startTime` and `stopTime` [ps].
+
+        """
+        if self.index is None:
+            self.buildIndex()
+        first, end = 0, len(self.index)
+        if startTime is not None:
+            # the time ranges of T3 chunks can overlap a bit, so the last ends are searched with a running maximum
+            first = int(np.searchsorted(np.maximum.accumulate(self.index[:, 3]), startTime, 'left'))
+        if stopTime is not None:
+            end = int(np.searchsorted(np.minimum.accumulate(self.index[::-1, 2])[::-1], stopTime, 'left'))
+        return first, max(end, first)
+
+
+    def decodeBlocks(self, first: int, end: int, startTime: typing.Optional[float] = None, stopTime: typing.Optional[float] = None):
+        """
+Decodes the chunks [first, end) and returns the events between `startTime` and `stopTime` [ps].
+
+Returns
+-------
+    tuple [1DArray, 1DArray]
+        times: `Unfold` timetags
+        channels: `Unfold` channels
+
+        """
+        if self.index is None:
+            self.buildIndex()
+        head = struct.calcsize('<QQqqII')
+        timesOut, channelsOut = [], []
+        for pos in self.index[first:end, 0]:
+            with self.lock:
+                self.file.seek(int(pos))
+                num, firstTime, firstPs, lastPs, timeLen, chanLen = struct.unpack('<QQqqII', self.file.read(head))
+                data = self.file.read(timeLen + chanLen)
+            timesOut.append(decodeTimes(zlib.decompress(data[:timeLen]), firstTime))
+            channelsOut.append(np.frombuffer(zlib.decompress(data[timeLen:]), dtype=np.uint8))
+        if not timesOut:
+            return np.zeros(0, dtype=np.uint64), np.zeros(0, dtype=np.uint8)
+        times, channels = np.concatenate(timesOut), np.concatenate(channelsOut)
+        if startTime is not None or stopTime is not None:
+            ps = unfoldToPs(times, self.isT3, self.syncPeriod, self.resolution)
+            inside = np.ones(len(ps), dtype=bool)
+            if startTime is not None:
+                inside &= ps >= startTime
+            if stopTime is not None:
+                inside &= ps < stopTime
+            times, channels = times[inside], channels[inside]
+        return times, channels
+
+
+def compressPTU(ptuPath: str, ttzPath: str, chunkSize: int = 1 << 20, numThreads: int = 2, level: int = 1):
+    """
+Converts a ptu file into a compressed container file (see :class:`TTZWriter`).
+
+Returns
+-------
+    tuple [int, int]
+        numEvents: int
+            number of events
+        numBytes: int
+            size of the compressed data [bytes]
+
+    """
+    ptu = PTUFile(ptuPath)
+    ptu.buildIndex()
+    isT3 = ptu.decoder.isT3
+    writer = TTZWriter(ttzPath, isT3, ptu.syncPeriod, ptu.resolution, ptu.resolution if isT3 else ptu.decoder.timeFactor,
+                       ptu.tags.get("HW_InpChannels", 64) + 1, chunkSize, numThreads, level)
+    step = max(chunkSize // ptu.indexStep, 1)
+    for first in range(0, ptu.numBlocks(), step):
+        writer.append(*ptu.decodeBlocks(first, min(first + step, ptu.numBlocks())))
+    if not writer.close():
+        raise writer.error
+    return writer.numEvents, writer.numBytes
+
+
+class ChannelStore:
+    """
+This stores the timetags of an `Unfold` data stream split by channel. Each block is bucketed in one pass and the
+times are appended to growable arrays of one channel each (sync, the input channels and each marker combination).
+So the times of a channel can be taken as a view without scanning the interleaved data again, and the memory
+grows with the number of events of each channel only.
+
+Parameters
+----------
+    minCapacity: int
+        | initial number of times per channel (the capacity is doubled if needed)
+
+    """
+
+    def __init__(self, minCapacity: int = 65536):
+        self.minCapacity = minCapacity
+        self.data = [None] * 256
+        self.lengths = np.zeros(256, dtype=np.int64)
+
+
+    def append(self, times, channels):
+        if not len(times):
+            return
+        channels = np.asarray(channels, dtype=np.uint8)
+        counts = np.bincount(channels, minlength=256)
+        # one stable sort buckets the block, the times of each channel keep their order
+        sortedTimes = np.asarray(times, dtype=np.uint64)[np.argsort(channels, kind='stable')]
+        ends = np.cumsum(counts)
+        for c in np.flatnonzero(counts):
+            self._extend(c, sortedTimes[ends[c] - counts[c]:ends[c]])
+
+
+    def view(self, channel: int):
+        if self.data[channel] is None:
+            return np.empty(0, dtype=np.uint64)
+        return self.data[channel][:self.lengths[channel]]
+
+
+    def clear(self):
+        self.data = [None] * 256
+        self.lengths[:] = 0
+
+
+    def _extend(self, channel, times):
+        length = self.lengths[channel]
+        needed = length + len(times)
+        store = self.data[channel]
+        if store is None or needed > len(store):
+            capacity = max(self.minCapacity, len(store) if store is not None else 0)
+            while capacity < needed:
+                capacity *= 2
+            grown = np.empty(capacity, dtype=np.uint64)
+            if store is not None:
+                grown[:length] = store[:length]
+            self.data[channel] = store = grown
+        store[length:needed] = times
+        self.lengths[channel] = needed
+
+
+def mergeSorted(blocks):
+    """
+Merges time-ordered blocks of `Unfold` data (times, channels) into one time-ordered block (k-way merge). Events
+with equal times keep the order of the blocks.
+
+    """
+    if not blocks:
+        return np.zeros(0, dtype=np.uint64), np.zeros(0, dtype=np.uint8)
+    times = np.concatenate([b[0] for b in blocks])
+    channels = np.concatenate([b[1] for b in blocks])
+    order = np.argsort(times, kind='stable')
+    return times[order], channels[order]
+
+
+class DelayQueue:
+    """
+This is the queue of the delayed events of a delay stage of the :class:`snAPI.Main.ManipulatorChain`. A constant
+delay keeps the order of the events, so the events leave the queue in the order they came in, and the queue is a
+ring buffer: pushing and popping an event costs O(1), and only the events up to a time are searched at the head.
+The memory grows (in powers of 2) to the peak number of waiting events only, which is about the count rate
+times the delay. The peak is kept in :obj:`peakDepth` to size the queue.
+
+Parameters
+----------
+    capacity: int
+        | initial number of events
+
+    """
+
+    def __init__(self, capacity: int = 65536):
+        self.ps = np.empty(capacity, dtype=np.int64)
+        self.times = np.empty(capacity, dtype=np.uint64)
+        self.head = 0
+        self.size = 0
+        self.peakDepth = 0
+        """maximum number of events that were waiting at once"""
+
+
+    def push(self, ps, times):
+        num = len(ps)
+        if self.size + num > len(self.ps):
+            self._grow(self.size + num)
+        capacity = len(self.ps)
+        tail = (self.head + self.size) % capacity
+        first = min(num, capacity - tail)
+        self.ps[tail:tail + first] = ps[:first]
+        self.times[tail:tail + first] = times[:first]
+        self.ps[:num - first] = ps[first:]
+        self.times[:num - first] = times[first:]
+        self.size += num
+        self.peakDepth = max(self.peakDepth, self.size)
+
+
+    def pop(self, until=None):
+        """
+Removes and returns (ps, times) of all events up to the time `until` [ps] (all events if None).
+
+        """
+        capacity = len(self.ps)
+        end = min(self.head + self.size, capacity)
+        wrapped = self.head + self.size - end
+        if until is None:
+            num = self.size
+        else:
+            num = int(np.searchsorted(self.ps[self.head:end], until, 'right'))
+            if num == end - self.head and wrapped:
+                num += int(np.searchsorted(self.ps[:wrapped], until, 'right'))
+        first = min(num, end - self.head)
+        ps = np.concatenate((self.ps[self.head:self.head + first], self.ps[:num - first]))
+        times = np.concatenate((self.times[self.head:self.head + first], self.times[:num - first]))
+        self.head = (self.head + num) % capacity
+        self.size -= num
+        return ps, times
+
+
+    def _grow(self, needed):
+        capacity = len(self.ps)
+        while capacity < needed:
+            capacity *= 2
+        ps, times = self.pop()
+        self.ps = np.empty(capacity, dtype=np.int64)
+        self.times = np.empty(capacity, dtype=np.uint64)
+        self.head = 0
+        self.size = len(ps)
+        self.ps[:self.size] = ps
+        self.times[:self.size] = times
+
+
+class PagedHistogram:
+    """
+This is the sparse storage of histograms with 64 bit counters. The bins of all rows (channels) are split into
+pages of `pageSize` bins and a page is allocated at the first count in it. So histograms with many empty bins
+(e.g. many channels with a large number of bins) only need the memory of the pages that were hit.
+
+Parameters
+----------
+    numRows: int
+        | number of histograms (channels)
+    numBins: int
+        | number of bins of each histogram
+    pageSize: int
+        | number of bins per page
+
+    """
+
+    def __init__(self, numRows: int, numBins: int, pageSize: int = 4096):
+        self.numRows = numRows
+        self.numBins = numBins
+        self.pageSize = pageSize
+        self.pagesPerRow = -(-numBins // pageSize)
+        self.table = np.full(numRows * self.pagesPerRow, -1, dtype=np.int64)
+        self.pages = np.zeros((0, pageSize), dtype=np.int64)
+        self.numPages = 0
+
+
+    def add(self, rows, bins):
+        """
+Counts the events at the `bins` of the `rows`.
+
+        """
+        if not len(bins):
+            return
+        rows = np.asarray(rows, dtype=np.int64)
+        bins = np.asarray(bins, dtype=np.int64)
+        pageIdx = rows * self.pagesPerRow + bins // self.pageSize
+        new = np.unique(pageIdx[self.table[pageIdx] < 0])
+        if len(new):
+            self._allocate(new)
+        flat = self.table[pageIdx] * self.pageSize + bins % self.pageSize
+        self.pages[:self.numPages] += np.bincount(flat, minlength=self.numPages * self.pageSize).reshape(self.numPages, self.pageSize)
+
+
+    def clear(self):
+        self.pages[:self.numPages] = 0
+
+
+    def toDense(self):
+        """
+Returns the histograms as a dense 2D array (numRows, numBins).
+
+        """
+        dense = np.zeros((self.numRows, self.pagesPerRow * self.pageSize), dtype=np.int64)
+        used = np.flatnonzero(self.table >= 0)
+        view = dense.reshape(-1, self.pageSize)
+        view[used] = self.pages[self.table[used]]
+        return dense[:, :self.numBins]
+
+
+    def nonzero(self):
+        """
+Returns (rows, bins, counts) of all bins with counts.
+
+        """
+        used = np.flatnonzero(self.table >= 0)
+        pages = self.pages[self.table[used]]
+        pageNum, offset = np.nonzero(pages)
+        first = (used[pageNum] % self.pagesPerRow) * self.pageSize
+        return used[pageNum] // self.pagesPerRow, first + offset, pages[pageNum, offset]
+
+
+    def nbytes(self):
+        return self.table.nbytes + self.numPages * self.pageSize * 8
+
+
+    def _allocate(self, pageIdx):
+        needed = self.numPages + len(pageIdx)
+        if needed > len(self.pages):
+            grown = np.zeros((max(needed, 2 * len(self.pages)), self.pageSize), dtype=np.int64)
+            grown[:self.numPages] = self.pages[:self.numPages]
+            self.pages = grown
+        self.table[pageIdx] = np.arange(self.numPages, needed)
+        self.numPages = needed
+
+
+def logBinEdges(minTime: float, maxTime: float, numBins: int):
+    """
+Returns the `numBins` + 1 edges [ps] of logarithmic bins. The first bin is [0, minTime) and the other bins grow
+by a constant factor up to `maxTime`.
+
+    """
+    return np.concatenate(([0.0], np.geomspace(minTime, maxTime, numBins)))
+
+
+class StageStats:
+    """
+This holds the telemetry of one stage of the :class:`snAPI.Main.Pipeline` (the source, a manipulator of the chain
+or a consumer): the number of batches and events in and out, the time spent and a histogram of the batch times
+in powers of 2 ns. Each counter is written by the one thread that runs the stage only, so no lock is needed
+and recording a batch costs two clock reads and a few additions.
+
+Parameters
+----------
+    name: str
+        | name of the stage
+
+    """
+
+    def __init__(self, name: str):
+        self.name = name
+        self.numBatches = 0
+        self.eventsIn = 0
+        self.eventsOut = 0
+        self.timeNs = 0
+        self.maxNs = 0
+        self.maxBatch = 0
+        self.queueHighWater = 0
+        self.hist = [0] * 48
+        """number of batches by time: hist[k] counts the batches of [2^(k-1), 2^k) ns"""
+
+
+    def record(self, eventsIn: int, eventsOut: int, ns: int):
+        self.numBatches += 1
+        self.eventsIn += eventsIn
+        self.eventsOut += eventsOut
+        self.timeNs += ns
+        if ns > self.maxNs:
+            self.maxNs = ns
+        if eventsIn > self.maxBatch:
+            self.maxBatch = eventsIn
+        self.hist[min(ns.bit_length(), 47)] += 1
+
+
+    def queued(self, depth: int):
+        if depth > self.queueHighWater:
+            self.queueHighWater = depth
+
+
+    def percentile(self, p: float):
+        """
+Returns the upper bound [ns] of the batch time below which `p` percent of the batches are.
+
+        """
+        if not self.numBatches:
+            return 0
+        limit = self.numBatches * p / 100
+        total = 0
+        for k, num in enumerate(self.hist):
+            total += num
+            if total >= limit:
+                return 1 << k
+        return 1 << (len(self.hist) - 1)
+
+
+    def toDict(self):
+        seconds = self.timeNs * 1e-9
+        return {
+            "NumBatches": self.numBatches,
+            "EventsIn": self.eventsIn,
+            "EventsOut": self.eventsOut,
+            "MeanBatch": self.eventsIn / self.numBatches if self.numBatches else 0,
+            "MaxBatch": self.maxBatch,
+            "Time": seconds,
+            "MaxTime": self.maxNs * 1e-9,
+            "P50Time": self.percentile(50) * 1e-9,
+            "P99Time": self.percentile(99) * 1e-9,
+            "EventRate": self.eventsIn / seconds if seconds else 0,
+            "QueueHighWater": self.queueHighWater,
+        }
+
+
+class SyntheticStream:
+    """
+This generates synthetic TTTR records (the generic T2 or T3 record format of the HydraHarp V2 and MultiHarp) with
+known statistics, e.g. to measure the processing throughput without a device (see tools/Tool_Benchmark.py).
+The events of each channel are Poisson distributed with the given `rates`, and with a `burstSize` > 1 they come in
+bursts (the number of events per burst is 1 + Poisson(burstSize - 1) within `burstWidth`). In T3 the dTimes decay
+exponentially with `decayTime`. The overflow density follows from the timetag `resolution` in T2 and the
+`syncRate` in T3.
+
+Parameters
+----------
+    isT3: bool
+        | T3 records (else T2)
+    rates: List[float]
+        | count rate of each channel [1/s]
+    syncRate: float
+        | sync rate [1/s] (T2: 0 for no sync events)
+    resolution: float
+        | T2: timetag resolution [ps], T3: dTime resolution [ps]
+    burstSize: float
+        | mean number of events per burst
+    burstWidth: float
+        | duration of a burst [ps]
+    decayTime: float
+        | decay time of the dTimes in T3 [ps]
+    seed: int
+        | seed of the random generator
+
+    """
+
+    def __init__(self, isT3: bool, rates: typing.List[float], syncRate: float = 1e7, resolution: float = 5.0,
+                 burstSize: float = 1.0, burstWidth: float = 1000.0, decayTime: float = 2000.0, seed: int = 0):
+        self.isT3 = isT3
+        self.rates = list(rates)
+        self.syncRate = syncRate
+        self.resolution = resolution
+        self.burstSize = max(burstSize, 1.0)
+        self.burstWidth = burstWidth
+        self.decayTime = decayTime
+        self.rng = np.random.default_rng(seed)
+        self.wrap = 1024 if isT3 else 33554432
+        self.lastOverflow = 0
+        self.numEvents = 0
+
+
+    def tags(self):
+        """
+Returns the ptu header tags of the stream (see :func:`writePTUHeader`).
+
+        """
+        return {
+            "File_GUID": "{00000000-0000-0000-0000-%012X}" % (self.rng.integers(1 << 47)),
+            "CreatorSW_Name": "snAPI SyntheticStream",
+            "Measurement_Mode": 3 if self.isT3 else 2,
+            "Measurement_SubMode": 0,
+            "HW_InpChannels": len(self.rates),
+            "TTResultFormat_TTTRRecType": 0x00010307 if self.isT3 else 0x00010207,
+            "TTResultFormat_BitsPerRecord": 32,
+            "MeasDesc_GlobalResolution": 1 / self.syncRate if self.isT3 else self.resolution * 1e-12,
+            "MeasDesc_Resolution": self.resolution * 1e-12,
+            "TTResult_SyncRate": int(self.syncRate),
+        }
+
+
+    def block(self, startTime: float, duration: float):
+        """
+Returns the records of the events between `startTime` and `startTime` + `duration` [ps]. The blocks have to
+be taken in time order.
+
+        """
+        times, chans = [np.zeros(0)], [np.zeros(0, dtype=np.int64)]
+        for c, rate in enumerate(self.rates):
+            numBursts = self.rng.poisson(rate * duration * 1e-12 / self.burstSize)
+            starts = startTime + self.rng.random(numBursts) * duration
+            sizes = 1 + self.rng.poisson(self.burstSize - 1, numBursts) if self.burstSize > 1 else np.ones(numBursts, dtype=np.int64)
+            t = np.repeat(starts, sizes)
+            if self.burstSize > 1:
+                t += self.rng.random(len(t)) * self.burstWidth
+            times.append(t[t < startTime + duration])
+            chans.append(np.full(len(times[-1]), c, dtype=np.int64))
+        times, chans = np.concatenate(times), np.concatenate(chans)
+        period = 1e12 / self.syncRate if self.syncRate else 0.0
+        if self.isT3:
+            # the photons are assigned to the sync periods, the dTimes decay exponentially
+            nSync = np.floor(times / period).astype(np.int64)
+            dTime = np.floor(self.rng.exponential(self.decayTime, len(times)) / self.resolution).astype(np.int64)
+            valid = dTime < 0x8000
+            nSync, dTime, chans = nSync[valid], dTime[valid], chans[valid]
+            order = np.lexsort((dTime, nSync))
+            nSync, dTime, chans = nSync[order], dTime[order], chans[order]
+            overflow = nSync // self.wrap
+            records = (chans << 25) | (dTime << 10) | (nSync % self.wrap)
+        else:
+            special = np.zeros(len(times), dtype=np.int64)
+            if period:
+                first = np.ceil(startTime / period)
+                syncs = np.arange(first, np.ceil((startTime + duration) / period)) * period
+                times = np.concatenate((times, syncs))
+                chans = np.concatenate((chans, np.zeros(len(syncs), dtype=np.int64)))
+                special = np.concatenate((special, np.ones(len(syncs), dtype=np.int64)))
+            order = np.argsort(times, kind='stable')
+            tags = np.floor(times[order] / self.resolution).astype(np.int64)
+            chans, special = chans[order], special[order]
+            overflow = tags // self.wrap
+            records = (special << 31) | (chans << 25) | (tags % self.wrap)
+        # overflow records with the number of overflows go before the first event after them, a larger gap than
+        # the count field holds (T3: 10 bits, T2: 25 bits) is split into several records
+        steps = np.diff(overflow, prepend=self.lastOverflow)
+        pos = np.flatnonzero(steps)
+        if len(overflow):
+            self.lastOverflow = int(overflow[-1])
+        maxStep = self.wrap - 1
+        steps = steps[pos]
+        numRecords = -(-steps // maxStep)
+        counts = np.full(int(numRecords.sum()), maxStep, dtype=np.int64)
+        # the last record of each gap holds the rest
+        counts[np.cumsum(numRecords) - 1] = steps - maxStep * (numRecords - 1)
+        records = np.insert(records, np.repeat(pos, numRecords), (0x7F << 25) | counts)
+        self.numEvents += len(records) - len(counts)
+        return records.astype(np.uint32)
+
+
+    def blocks(self, duration: float, blockTime: float = 0.01):
+        """
+Yields the records of `duration` [s] in blocks of `blockTime` [s].
+
+        """
+        num = int(np.ceil(duration / blockTime))
+        for i in range(num):
+            yield self.block(i * blockTime * 1e12, min(blockTime, duration - i * blockTime) * 1e12)
+
+
+    def writePTU(self, path: str, duration: float, blockTime: float = 0.01):
+        """
+Writes `duration` [s] of the stream into a ptu file (with a :class:`PTUWriter`).
+
+Returns
+-------
+    int: number of records
+
+        """
+        writer = PTUWriter(path, self.tags())
+        for records in self.blocks(duration, blockTime):
+            writer.write(records)
+        writer.close()
+        return writer.numRecords
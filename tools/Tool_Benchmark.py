@@ -0,0 +1,117 @@
+import sys
+import os
+import time
+import argparse
+import tempfile
+sys.path.insert(0, os.path.abspath(os.path.join(os.path.dirname(__file__), '..')))
+
+from snAPI.Main import *
+
+# Measures the processing throughput of snAPI without a device. A synthetic T2 or T3 stream is written to a
+# ptu file and then processed by the file device of the API (Histogram, TimeTrace, Correlation) and by the
+# Pipeline (decoding, manipulators and consumers). The results are printed as JSON and can be compared
+# between releases, e.g.:
+#
+#   python Tool_Benchmark.py --mode T2 --chans 8 --rate 5e6 --duration 10 --json bench.json
+
+
+def stage(name, numEvents, seconds):
+    return {
+        "Name": name,
+        "Events": int(numEvents),
+        "Time": seconds,
+        "EventRate": numEvents / seconds if seconds else 0,
+        "NsPerEvent": seconds * 1e9 / numEvents if numEvents else 0,
+    }
+
+
+def benchDecode(path):
+    file = PTUFile(path)
+    start = time.perf_counter()
+    file.buildIndex(cache=False)
+    numEvents = 0
+    step = 16
+    for first in range(0, file.numBlocks(), step):
+        times, channels = file.decodeBlocks(first, min(first + step, file.numBlocks()))
+        numEvents += len(times)
+    return stage("Decode", numEvents, time.perf_counter() - start)
+
+
+def benchPipeline(sn, path, args):
+    sn.pipeline.histogram(0)
+    sn.pipeline.timeTrace(1000, 1)
+    sn.pipeline.correlation(1, 2, args.window, args.binWidth)
+    if args.manipulators:
+        sn.manipulators.clearAll()
+        sn.manipulators.coincidence([1, 2], args.window)
+        sn.manipulators.compile()
+    start = time.perf_counter()
+    sn.pipeline.startFile(path, waitFinished=True, numThreads=args.threads)
+    seconds = time.perf_counter() - start
+    stats = sn.pipeline.getStats()
+    results = []
+    for name, s in stats.items():
+        results.append(dict(stage("Pipeline." + name, s["EventsIn"], s["Time"]), P99BatchTime=s["P99Time"], MeanBatch=s["MeanBatch"]))
+    results.append(stage("Pipeline", stats["Source"]["EventsIn"], seconds))
+    if args.manipulators:
+        sn.manipulators.clearAll()
+    return results
+
+
+def benchAPI(sn, numEvents, args):
+    results = []
+    # the acquisition time has to cover the whole stream, otherwise only a part of the events is measured
+    acqTime = int(np.ceil(args.duration * 1000)) + 1000
+    sn.histogram.setRefChannel(0)
+    measurements = [("API.Histogram", lambda: sn.histogram.measure(acqTime, waitFinished=True)),
+                    ("API.TimeTrace", lambda: sn.timeTrace.measure(acqTime, waitFinished=True)),
+                    ("API.Correlation", lambda: sn.correlation.measure(acqTime, waitFinished=True))]
+    sn.correlation.setG2Parameters(1, 2, args.window, args.binWidth)
+    for name, measure in measurements:
+        start = time.perf_counter()
+        measure()
+        results.append(stage(name, numEvents, time.perf_counter() - start))
+    return results
+
+
+if(__name__ == "__main__"):
+
+    parser = argparse.ArgumentParser(description="snAPI throughput benchmark over synthetic TTTR streams")
+    parser.add_argument("--mode", choices=["T2", "T3"], default="T2", help="measurement mode (default: T2)")
+    parser.add_argument("--chans", type=int, default=4, help="number of channels (default: 4)")
+    parser.add_argument("--rate", type=float, default=1e6, help="count rate per channel [1/s] (default: 1e6)")
+    parser.add_argument("--syncRate", type=float, default=1e7, help="sync rate [1/s], T2: 0 for no sync (default: 1e7)")
+    parser.add_argument("--resolution", type=float, default=5, help="T2 timetag / T3 dTime resolution [ps] (default: 5)")
+    parser.add_argument("--burstSize", type=float, default=1, help="mean events per burst (default: 1 - Poisson)")
+    parser.add_argument("--burstWidth", type=float, default=1000, help="width of a burst [ps] (default: 1000)")
+    parser.add_argument("--duration", type=float, default=10, help="duration of the stream [s] (default: 10)")
+    parser.add_argument("--window", type=float, default=10000, help="correlation / coincidence window [ps] (default: 10000)")
+    parser.add_argument("--binWidth", type=float, default=100, help="correlation bin width [ps] (default: 100)")
+    parser.add_argument("--threads", type=int, default=None, help="decoding threads of the pipeline (default: all cores)")
+    parser.add_argument("--manipulators", action="store_true", help="run a compiled coincidence manipulator in the pipeline")
+    parser.add_argument("--noAPI", action="store_true", help="skip the measurements of the API file device")
+    parser.add_argument("--path", default=None, help="ptu file of the stream (default: temporary file)")
+    parser.add_argument("--json", default=None, help="write the results to this file")
+    args = parser.parse_args()
+
+    path = args.path or os.path.join(tempfile.gettempdir(), "snAPI_benchmark.ptu")
+    stream = SyntheticStream(args.mode == "T3", [args.rate] * args.chans, args.syncRate, args.resolution,
+                             args.burstSize, args.burstWidth)
+    start = time.perf_counter()
+    numRecords = stream.writePTU(path, args.duration)
+    stages = [stage("Generate", stream.numEvents, time.perf_counter() - start)]
+    stages.append(benchDecode(path))
+
+    sn = snAPI()
+    # the manipulators need an opened device
+    hasDevice = sn.getFileDevice(path)
+    stages += benchPipeline(sn, path, args)
+    if not args.noAPI and hasDevice:
+        stages += benchAPI(sn, stream.numEvents, args)
+
+    results = {"Config": vars(args), "NumRecords": int(numRecords), "NumEvents": int(stream.numEvents),
+               "FileSize": os.path.getsize(path), "Stages": stages}
+    sn.logPrint(json.dumps(results, indent=2))
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
@@ -0,0 +1,272 @@
+import sys
+import os
+import argparse
+import tempfile
+sys.path.insert(0, os.path.abspath(os.path.join(os.path.dirname(__file__), '..')))
+
+import numpy as np
+from snAPI.Utils import *
+
+# Checks the numpy kernels of snAPI against simple reference implementations with small deterministic data: the
+# record decoder (with the overflow records of T2 and T3), the overflow index of the ptu file, the ttz container,
+# histPairs, gateIndex and the DelayQueue. If the snAPI.dll can be loaded, the FCS and coincidence consumers of the
+# pipeline are checked as well, and the decoded records are compared with the Unfold data of the API file device.
+# Every check prints OK or FAILED, and the exit code is the number of failed checks, e.g.:
+#
+#   python Tool_CheckKernels.py --mode T3
+
+failures = []
+
+
+def check(name, ok, detail=""):
+    print(f"{'OK    ' if ok else 'FAILED'} {name}" + (f" ({detail})" if detail and not ok else ""))
+    if not ok:
+        failures.append(name)
+
+
+def same(a, b):
+    return len(a) == len(b) and bool(np.array_equal(np.asarray(a), np.asarray(b)))
+
+
+def refDecode(records, isT3, timeFactor):
+    # one record after the other like in the description of the generic T2/T3 records (HydraHarp V2, MultiHarp)
+    times, channels = [], []
+    overflows = 0
+    for r in records.tolist():
+        special = r >> 31
+        chan = (r >> 25) & 0x3F
+        if isT3:
+            nSync, dTime = r & 0x3FF, (r >> 10) & 0x7FFF
+            if special and chan == 0x3F:
+                overflows += nSync or 1
+                continue
+            times.append(((overflows * 1024 + nSync) << 15) | dTime)
+        else:
+            tag = r & 0x1FFFFFF
+            if special and chan == 0x3F:
+                overflows += tag or 1
+                continue
+            times.append(round((overflows * 33554432 + tag) * timeFactor))
+        if not special:
+            channels.append(chan + 1)
+        elif chan == 0 and not isT3:
+            channels.append(0)
+        else:
+            channels.append(0x80 | chan)
+    return np.array(times, dtype=np.uint64), np.array(channels, dtype=np.uint8)
+
+
+def refHistPairs(stops, starts, window, binWidth, numBins):
+    diffs = (stops[:, None] - starts[None, :]).ravel()
+    bins = np.floor((diffs + window) / binWidth).astype(np.int64)
+    return np.bincount(bins[(bins >= 0) & (bins < numBins)], minlength=numBins)
+
+
+def refGateIndex(heralds, times, delayTime, gateTime):
+    # the latest herald whose gate contains the event
+    result = np.full(len(times), -1, dtype=np.int64)
+    for i, t in enumerate(times.tolist()):
+        for j, h in enumerate(heralds.tolist()):
+            if h + delayTime <= t < h + delayTime + gateTime:
+                result[i] = j
+    return result
+
+
+def refCountAll(ps, bits, window):
+    counts = {}
+    for i in range(len(ps)):
+        pattern = 0
+        j = i
+        while j >= 0 and ps[j] >= ps[i] - window:
+            pattern |= int(bits[j])
+            j -= 1
+        counts[pattern] = counts.get(pattern, 0) + 1
+    return counts
+
+
+def refCountOnce(ps, bits, window):
+    counts = {}
+    i = 0
+    while i < len(ps):
+        pattern = 0
+        j = i
+        while j < len(ps) and ps[j] <= ps[i] + window:
+            pattern |= int(bits[j])
+            j += 1
+        counts[pattern] = counts.get(pattern, 0) + 1
+        i = j
+    return counts
+
+
+def refFCS(a, b, tau0, levelLags):
+    # the counts of every level in dense bins, correlated at the lags of the level
+    sums = []
+    for level, lags in enumerate(levelLags):
+        width = tau0 << level
+        size = int(max(a.max(), b.max()) // width) + 1
+        binsA = np.bincount(a // width, minlength=size)
+        binsB = np.bincount(b // width, minlength=size)
+        for lag in lags:
+            sums.append((int(np.dot(binsA[:-lag], binsB[lag:])), int(np.dot(binsB[:-lag], binsA[lag:]))))
+    return np.array(sums, dtype=np.int64).reshape(-1, 2).T
+
+
+def checkDecoder(name, stream, duration):
+    records = np.concatenate(list(stream.blocks(duration)))
+    tags = stream.tags()
+    decoder = RecordDecoder(tags["TTResultFormat_TTTRRecType"], tags["MeasDesc_GlobalResolution"])
+    refTimes, refChannels = refDecode(records, stream.isT3, decoder.timeFactor)
+    times, channels = decoder.decode(records)
+    check(f"{name}: decode against the reference", same(times, refTimes) and same(channels, refChannels))
+    parts = [decoder.decodeNext(records[i:i + 777]) for i in range(0, len(records), 777)]
+    check(f"{name}: decodeNext over blocks", same(np.concatenate([p[0] for p in parts]), refTimes))
+    check(f"{name}: number of events", len(refTimes) == stream.numEvents, f"{len(refTimes)} != {stream.numEvents}")
+    clock = refTimes >> np.uint64(15) if stream.isT3 else refTimes
+    end = duration * (stream.syncRate if stream.isT3 else 1e12)
+    check(f"{name}: times in order and inside the stream", bool(np.all(np.diff(clock.astype(np.int64)) >= 0)) and float(clock[-1]) < end)
+    return records, refTimes, refChannels
+
+
+def checkFiles(name, stream, duration, records, refTimes, refChannels, folder):
+    path = os.path.join(folder, f"check_{name}.ptu")
+    writer = PTUWriter(path, stream.tags())
+    writer.write(records)
+    check(f"{name}: PTUWriter", writer.close(), str(writer.error))
+    ptu = PTUFile(path)
+    # small index blocks, so many blocks start with the carried overflows
+    ptu.indexStep = 1024
+    ptu.buildIndex()
+    times, channels = ptu.decodeBlocks(0, ptu.numBlocks())
+    check(f"{name}: PTUFile blocks", same(times, refTimes) and same(channels, refChannels))
+    ps = unfoldToPs(refTimes, stream.isT3, ptu.syncPeriod, ptu.resolution)
+    startPs, stopPs = 0.3 * duration * 1e12, 0.6 * duration * 1e12
+    first, end = ptu.blockRange(startPs, stopPs)
+    times, channels = ptu.decodeBlocks(first, end, startPs, stopPs)
+    inside = (ps >= startPs) & (ps < stopPs)
+    check(f"{name}: PTUFile time range", same(times, refTimes[inside]) and same(channels, refChannels[inside]))
+
+    # the T3 times of equal syncs are not strictly ordered, the zig-zag code has to keep small negative steps
+    shuffled = refTimes.copy()
+    num = len(shuffled) // 2 * 2
+    shuffled[:num] = shuffled[:num].reshape(-1, 2)[:, ::-1].ravel()
+    check(f"{name}: encodeTimes/decodeTimes", same(decodeTimes(encodeTimes(shuffled), int(shuffled[0])), shuffled))
+
+    ttzPath = os.path.join(folder, f"check_{name}.ttz")
+    writer = TTZWriter(ttzPath, stream.isT3, ptu.syncPeriod, ptu.resolution, ptu.resolution if stream.isT3 else ptu.decoder.timeFactor,
+                       len(stream.rates) + 1, chunkSize=4096)
+    for i in range(0, len(refTimes), 1000):
+        writer.append(refTimes[i:i + 1000], refChannels[i:i + 1000])
+    check(f"{name}: TTZWriter", writer.close(), str(writer.error))
+    ttz = TTZFile(ttzPath)
+    times, channels = ttz.decodeBlocks(0, ttz.numBlocks())
+    check(f"{name}: TTZ round trip", same(times, refTimes) and same(channels, refChannels))
+    first, end = ttz.blockRange(startPs, stopPs)
+    times, channels = ttz.decodeBlocks(first, end, startPs, stopPs)
+    check(f"{name}: TTZ time range", same(times, refTimes[inside]))
+    ttz.file.close()
+    return path, ps
+
+
+def checkKernels(rng):
+    stops = np.sort(rng.integers(0, 5_000_000, 700))
+    starts = np.sort(rng.integers(0, 5_000_000, 900))
+    window, binWidth = 20000, 100
+    numBins = int(2 * window / binWidth)
+    hist = np.zeros(numBins, dtype=np.int64)
+    # few pairs per chunk, so the pairs are split into many chunks
+    histPairs(stops, starts, window, binWidth, hist, maxPairs=100)
+    check("histPairs against all pairs", same(hist, refHistPairs(stops, starts, window, binWidth, numBins)))
+    hist = np.zeros(numBins // 3, dtype=np.int64)
+    histPairs(stops, starts, window, binWidth * 3 / 2, hist)
+    check("histPairs with a fractional bin width", same(hist, refHistPairs(stops, starts, window, binWidth * 3 / 2, len(hist))))
+
+    heralds = np.sort(rng.integers(0, 1_000_000, 200))
+    times = rng.integers(0, 1_000_000, 500)
+    check("gateIndex against all heralds", same(gateIndex(heralds, times, 3000, 2000), refGateIndex(heralds, times, 3000, 2000)))
+    check("gateIndex without heralds", same(gateIndex(np.zeros(0, dtype=np.int64), times, 0, 1000), np.full(len(times), -1)))
+
+    queue, ref = DelayQueue(8), []
+    now = 0
+    ok = True
+    for _ in range(200):
+        num = int(rng.integers(0, 40))
+        ps = now + np.sort(rng.integers(0, 1000, num))
+        now += 1000
+        queue.push(ps, ps.astype(np.uint64))
+        ref += ps.tolist()
+        until = now - int(rng.integers(0, 3000))
+        popped, times = queue.pop(until)
+        expected = [p for p in ref if p <= until]
+        ref = ref[len(expected):]
+        ok &= popped.tolist() == expected and times.tolist() == expected
+    popped, _ = queue.pop()
+    check("DelayQueue against a list", ok and popped.tolist() == ref)
+
+
+def checkPipeline(name, sn, path, ps, refChannels):
+    # in T3 the consumers sort the times of a block, the reference sorts all of them
+    order = np.argsort(ps, kind='stable')
+    ps, chans = ps[order].astype(np.int64), refChannels[order]
+    fcs = sn.pipeline.fcs(1, 2, windowSize=1e9, startTime=1e6, intervalLength=8)
+    countAll = sn.pipeline.coincidenceMatrix([1, 2, 3], 20000, CoincidenceMode.CountAll)
+    countOnce = sn.pipeline.coincidenceMatrix([1, 2, 3], 20000, CoincidenceMode.CountOnce)
+    g2 = sn.pipeline.correlation(1, 2, 50000, 500)
+    sn.pipeline.startFile(path, waitFinished=True)
+    sumAB, sumBA = refFCS(ps[chans == 1], ps[chans == 2], fcs.tau0, fcs.levelLags)
+    check(f"{name}: FCS against dense bins", same(fcs.sumAB, sumAB) and same(fcs.sumBA, sumBA))
+    bitOf = np.zeros(256, dtype=np.int64)
+    bitOf[[1, 2, 3]] = [1, 2, 4]
+    used = bitOf[chans] != 0
+    for consumer, ref in ((countAll, refCountAll), (countOnce, refCountOnce)):
+        counts = ref(ps[used].tolist(), bitOf[chans[used]].tolist(), 20000)
+        expected = np.zeros(8, dtype=np.int64)
+        for pattern, count in counts.items():
+            expected[pattern] = count
+        check(f"{name}: coincidences {consumer.mode.name} against a loop", same(consumer.counts, expected))
+    a, b = ps[chans == 1], ps[chans == 2]
+    check(f"{name}: g(2) against all pairs", same(g2.hist[0], refHistPairs(b, a, 50000, 500, g2.numBins)))
+    sn.pipeline.clearAll()
+
+
+def checkAPI(name, sn, path, refTimes, refChannels, duration):
+    if not sn.getFileDevice(path):
+        check(f"{name}: API file device", False, "the file device could not be opened")
+        return
+    sn.unfold.measure(int(np.ceil(duration * 1000)) + 1000, size=len(refTimes) + 1024, waitFinished=True)
+    times, channels = sn.unfold.getData()
+    check(f"{name}: decoder against the Unfold data of the API", same(times, refTimes) and same(channels, refChannels),
+          f"{len(times)} / {len(refTimes)} events")
+
+
+if(__name__ == "__main__"):
+
+    parser = argparse.ArgumentParser(description="checks of the numpy kernels of snAPI against reference implementations")
+    parser.add_argument("--mode", choices=["T2", "T3", "both"], default="both", help="measurement mode (default: both)")
+    parser.add_argument("--noAPI", action="store_true", help="skip the checks that need the snAPI.dll")
+    args = parser.parse_args()
+
+    sn = None
+    if not args.noAPI:
+        try:
+            from snAPI.Main import *
+            sn = snAPI()
+        except Exception as e:
+            print(f"skipped the pipeline and API checks, the snAPI.dll can't be loaded ({e})")
+
+    folder = tempfile.mkdtemp(prefix="snAPI_check_")
+    checkKernels(np.random.default_rng(0))
+    for mode in (["T2", "T3"] if args.mode == "both" else [args.mode]):
+        isT3 = mode == "T3"
+        # sparse events with long gaps: many overflow records, in T3 also gaps of more than 1023 overflows
+        sparse = SyntheticStream(isT3, [20.0, 20.0], syncRate=1e7 if isT3 else 1e3, resolution=5.0, seed=1)
+        records, refTimes, refChannels = checkDecoder(f"{mode} sparse", sparse, 2.0)
+        checkFiles(f"{mode}_sparse", sparse, 2.0, records, refTimes, refChannels, folder)
+        dense = SyntheticStream(isT3, [1e5, 1e5, 1e5], syncRate=1e7 if isT3 else 0, resolution=5.0, burstSize=3, seed=1)
+        records, refTimes, refChannels = checkDecoder(f"{mode} dense", dense, 0.5)
+        path, ps = checkFiles(f"{mode}_dense", dense, 0.5, records, refTimes, refChannels, folder)
+        if sn is not None:
+            checkPipeline(f"{mode} dense", sn, path, ps, refChannels)
+            checkAPI(f"{mode} dense", sn, path, refTimes, refChannels, 0.5)
+
+    print(f"{len(failures)} checks failed" if failures else "all checks passed")
+    sys.exit(len(failures))